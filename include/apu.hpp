@@ -5,23 +5,24 @@
 #include "types.hpp"
 #include <array>
 #include <cstddef>
+#include <functional>
 #include <queue>
 #include <atomic>
 #include <mutex>
 
 class GameBoyAdvance;
+class StateSerializer;
 class GBAAPU {
 public:
 	GameBoyAdvance& bus;
 
 	GBAAPU(GameBoyAdvance& bus_);
 	void reset();
+	void serialize(StateSerializer& state);
 
 	int calculateSweepFrequency();
 
-	static void frameSequencerEvent(void *object);
 	void tickFrameSequencer();
-	static void sampleEvent(void *object);
 	void generateSample();
 
 	void onTimer(int timerNum);
@@ -33,6 +34,8 @@ public:
 	std::atomic<size_t> sampleBufferIndex;
 	std::array<i16, 2048> sampleBuffer;
 	bool apuBlock;
+	std::function<void()> onBufferFull; // If set, called to empty the full buffer instead of blocking. Nothing gets dropped this way.
+	bool discardSamples; // Set while running frames that will be thrown away
 
 	bool ch1OverrideEnable;
 	bool ch2OverrideEnable;
@@ -9,13 +9,16 @@
 #include "types.hpp"
 
 class GameBoyAdvance;
+class StateSerializer;
 class ARM7TDMI {
 public:
 	GameBoyAdvance& bus;
 
 	ARM7TDMI(GameBoyAdvance& bus_);
 	void resetARM7TDMI();
+	void serialize(StateSerializer& state);
 	void cycle();
+	u64 instructionsExecuted; // Only used for stats
 
 	enum cpuMode {
 		MODE_USER = 0x10,
@@ -55,6 +58,62 @@ public:
 		u32 R13_und, R14_und, SPSR_und;
 	} reg;
 
+	/* Lazy Flags */
+	// S instructions only record what they did. NZCV are worked out when a condition is checked,
+	// and only written back to CPSR when something needs the whole register.
+	enum flagOpType : u8 {
+		FLAGS_IN_CPSR, // reg.flagN/Z/C/V are up to date
+		FLAGS_LOGICAL, // N and Z from flagResult, C and V in flagCarry/flagOverflow
+		FLAGS_ADD, // flagResult = flagOperand1 + flagOperand2
+		FLAGS_SUB // flagResult = flagOperand1 - flagOperand2
+	};
+	flagOpType flagOp;
+	u32 flagResult;
+	u32 flagOperand1;
+	u32 flagOperand2;
+	bool flagCarry;
+	bool flagOverflow;
+
+	inline bool getFlagN() const { return (flagOp == FLAGS_IN_CPSR) ? (bool)reg.flagN : (bool)(flagResult >> 31); }
+	inline bool getFlagZ() const { return (flagOp == FLAGS_IN_CPSR) ? (bool)reg.flagZ : (flagResult == 0); }
+	inline bool getFlagC() const {
+		switch (flagOp) {
+		case FLAGS_IN_CPSR: return reg.flagC;
+		case FLAGS_LOGICAL: return flagCarry;
+		case FLAGS_ADD: return flagResult < flagOperand1;
+		default: return flagOperand1 >= flagOperand2;
+		}
+	}
+	inline bool getFlagV() const {
+		switch (flagOp) {
+		case FLAGS_IN_CPSR: return reg.flagV;
+		case FLAGS_LOGICAL: return flagOverflow;
+		case FLAGS_ADD: return (~(flagOperand1 ^ flagOperand2) & (flagOperand1 ^ flagResult)) >> 31;
+		default: return ((flagOperand1 ^ flagOperand2) & (flagOperand1 ^ flagResult)) >> 31;
+		}
+	}
+	inline void setFlags(u32 result, bool carry, bool overflow) {
+		flagOp = FLAGS_LOGICAL;
+		flagResult = result;
+		flagCarry = carry;
+		flagOverflow = overflow;
+	}
+	inline void setFlagsLogical(u32 result, bool carry) { setFlags(result, carry, getFlagV()); } // V is unchanged
+	inline void setFlagsAdd(u32 operand1, u32 operand2, u32 result) {
+		flagOp = FLAGS_ADD;
+		flagResult = result;
+		flagOperand1 = operand1;
+		flagOperand2 = operand2;
+	}
+	inline void setFlagsSub(u32 operand1, u32 operand2, u32 result) {
+		flagOp = FLAGS_SUB;
+		flagResult = result;
+		flagOperand1 = operand1;
+		flagOperand2 = operand2;
+	}
+	u32 readCPSR() const;
+	void materializeFlags(); // Must be called before reading or writing reg.CPSR directly
+
 	/* Instruction Decoding/Executing */
 	bool processIrq;
 	u32 pipelineOpcode1; // R15
@@ -113,6 +172,7 @@ public:
 
 	static const std::array<void (ARM7TDMI::*)(u32), 4096> LUT;
 	static const std::array<void (ARM7TDMI::*)(u16), 1024> thumbLUT;
+
 };
 
 #endif
\ No newline at end of file
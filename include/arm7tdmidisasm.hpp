@@ -27,6 +27,4 @@ private:
 	std::string disassembleShift(u32 opcode, bool showUpDown);
 };
 
-extern ARM7TDMIDisassembler disassembler; // TODO: This shouldn't be required
-
 #endif
\ No newline at end of file
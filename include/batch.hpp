@@ -0,0 +1,39 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <filesystem>
+#include <vector>
+
+#include "types.hpp"
+
+// Runs a manifest of ROMs headless across every core, one reused GameBoyAdvance per worker thread
+struct BatchCheckpoint {
+	int frame; // Hashed after this many frames
+	u64 frameHash;
+	u64 audioHash; // Every sample up to this point
+};
+
+struct BatchJob {
+	std::filesystem::path romFilePath;
+	int frames;
+	std::filesystem::path inputFilePath; // Empty if no input is given
+	std::vector<BatchCheckpoint> checkpoints; // Sorted, only the frame numbers need to be filled in
+
+	bool success;
+	u64 frameHash; // Framebuffer after the last frame
+	u64 audioHash; // Every sample generated during the run
+	double seconds;
+};
+
+struct BatchOptions {
+	int threads; // 0 uses every core
+	std::filesystem::path biosFilePath; // Empty for HLE BIOS
+};
+
+int loadBatchManifest(std::filesystem::path manifestFilePath, std::vector<BatchJob>& jobs);
+void runBatch(std::vector<BatchJob>& jobs, const BatchOptions& options);
+int runBatchManifest(std::filesystem::path manifestFilePath, const BatchOptions& options);
+
+u64 fnv1a(const void *data, size_t size, u64 hash = 0xCBF29CE484222325);
+
+#endif
@@ -5,10 +5,13 @@
 #include <cstdio>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "types.hpp"
 #include "arm7tdmi.hpp"
 #include "hlebios.hpp"
+#include "arm7tdmidisasm.hpp"
+#include "profiler.hpp"
 
 class GBACPU : public ARM7TDMI {
 public:
@@ -17,24 +20,72 @@ public:
 
 	GBACPU(GameBoyAdvance& bus_);
 	void reset();
+	void serialize(StateSerializer& state);
 	void run();
+	void step();
+
+	// Run ahead
+	int runAheadFrames; // 0 to turn off
+	bool runningAhead;
+	std::vector<u8> runAheadState;
+	u16 runAheadFramebuffer[160][240];
+	bool runAheadLineKeyValid[160];
+	void runAhead();
 
 	// Scheduler
-	struct Event {
-		u64 timeStamp;
-		void (*callback)(void*);
-		void *userData;
-		bool important;
-	};
-	struct eventSorter {
-		bool operator()(const Event &lhs, const Event &rhs);
+	enum eventType { // Events due on the same cycle run in this order
+		EVENT_PPU_LINE_START,
+		EVENT_PPU_HBLANK,
+		EVENT_TIMER0,
+		EVENT_TIMER1,
+		EVENT_TIMER2,
+		EVENT_TIMER3,
+		EVENT_DMA,
+		EVENT_APU_FRAME_SEQUENCER,
+		EVENT_APU_SAMPLE,
+		EVENT_MOVIE_INPUT,
+		EVENT_STOP,
+		EVENT_COUNT
 	};
 
-	void addEvent(u64 cycles, void (*function)(void*), void *pointer, bool important = false);
+	void clearEvents();
+	void reschedule(eventType id, u64 timeStamp, bool important = false);
+	void cancel(eventType id);
+	void findNextEvent();
 	void tickScheduler(int cycles);
 
 	u64 currentTime;
-	std::priority_queue<Event, std::vector<Event>, eventSorter> eventQueue;
+	u64 nextEventTime;
+	eventType nextEvent;
+	u64 eventTimes[EVENT_COUNT]; // UINT64_MAX if not scheduled
+	bool eventImportant[EVENT_COUNT];
+	u64 eventsProcessed; // Also tells step() when to return
+	static constexpr GBAProfiler::section eventSections[EVENT_COUNT] = {
+		GBAProfiler::PROFILE_PPU, // EVENT_PPU_LINE_START
+		GBAProfiler::PROFILE_PPU, // EVENT_PPU_HBLANK
+		GBAProfiler::PROFILE_CPU, // EVENT_TIMER0
+		GBAProfiler::PROFILE_CPU, // EVENT_TIMER1
+		GBAProfiler::PROFILE_CPU, // EVENT_TIMER2
+		GBAProfiler::PROFILE_CPU, // EVENT_TIMER3
+		GBAProfiler::PROFILE_DMA, // EVENT_DMA
+		GBAProfiler::PROFILE_APU, // EVENT_APU_FRAME_SEQUENCER
+		GBAProfiler::PROFILE_APU, // EVENT_APU_SAMPLE
+		GBAProfiler::PROFILE_CPU, // EVENT_MOVIE_INPUT
+		GBAProfiler::PROFILE_CPU // EVENT_STOP
+	};
+
+	// Idle loop detection
+	static constexpr u32 maxIdleLoopSize = 0x40;
+	bool skipIdleLoops;
+	bool idleLoopDirty; // Set by anything that could make the next iteration different
+	u32 idleLoopBranch;
+	u64 idleLoopStartTime;
+	u32 idleLoopRegs[16];
+	u32 idleLoopCPSR;
+	bool idleLoopPrefetchRunning;
+	int idleLoopPrefetchIndex;
+	int idleLoopPrefetchCycles;
+	void checkIdleLoop(u32 branchAddress);
 
 	// Interrupts
 	bool uncapFps;
@@ -70,7 +121,13 @@ public:
 		LOAD_BIOS,
 		LOAD_ROM,
 		UPDATE_KEYINPUT,
-		CLEAR_LOG
+		CLEAR_LOG,
+		SAVE_STATE,
+		LOAD_STATE,
+		RECORD_MOVIE,
+		PLAY_MOVIE,
+		STOP_MOVIE,
+		QUIT
 	};
 	struct threadEvent {
 		threadEventType type;
@@ -78,8 +135,12 @@ public:
 		void *ptrArg;
 	};
 	std::queue<threadEvent> threadQueue;
+	bool quitting; // Set by QUIT so run() returns and the thread can be joined
 	std::mutex threadQueueMutex;
 	void processThreadEvents();
+	threadEvent boundaryEvent; // Left for run() to handle once the current instruction is done
+	bool boundaryEventPending;
+	void processBoundaryEvent();
 	void addThreadEvent(threadEventType type);
 	void addThreadEvent(threadEventType type, u64 intArg);
 	void addThreadEvent(threadEventType type, void *ptrArg);
@@ -89,8 +150,7 @@ public:
 	bool traceInstructions;
 	bool logInterrupts;
 	std::string previousLogLine;
-
-	static void stopEvent(void *object);
+	ARM7TDMIDisassembler disassembler;
 };
 
 #endif
@@ -5,20 +5,21 @@
 #include "types.hpp"
 
 class GameBoyAdvance;
+class StateSerializer;
 class GBADMA {
 public:
 	GameBoyAdvance& bus;
 
 	GBADMA(GameBoyAdvance& bus_);
 	void reset();
-
-	static void dmaCheckEvent(void *object);
+	void serialize(StateSerializer& state);
 
 	void onVBlank();
 	void onHBlank();
 	void onFifoA();
 	void onFifoB();
 	void checkDma();
+	void scheduleCheck(); // Every queued channel is handled by the same check, so it can only move earlier
 	template <int channel> void doDma();
 	inline void dmaEnd();
 
@@ -27,6 +27,11 @@
 #include "dma.hpp"
 #include "ppu.hpp"
 #include "timer.hpp"
+#include "movie.hpp"
+#include "profiler.hpp"
+#include "rewind.hpp"
+#include "renderthread.hpp"
+#include "savestate.hpp"
 
 class GBACPU;
 class GBAPPU;
@@ -37,6 +42,10 @@ public:
 	GBADMA dma;
 	GBAPPU ppu;
 	GBATIMER timer;
+	GBAProfiler profiler;
+	GBARewind rewind;
+	GBAMovie movie;
+	GBARenderThread renderThread;
 
 	GameBoyAdvance();
 	~GameBoyAdvance();
@@ -47,8 +56,17 @@ public:
 	int loadRom(std::filesystem::path romFilePath_);
 	void save();
 
+	// Savestates. ROM and BIOS contents aren't included, so a state only loads with the same ROM.
+	void serialize(StateSerializer& state);
+	void saveState(std::vector<u8>& buffer);
+	int loadState(const std::vector<u8>& buffer);
+	int saveStateToFile(std::filesystem::path stateFilePath);
+	int loadStateFromFile(std::filesystem::path stateFilePath);
+	std::vector<u8> loadStateBackup;
+
 	u8 readDebug(u32 address);
 	template <typename T> T openBus(u32 address);
+	template <typename T, bool rotate> u32 finishRead(u32 address, u32 val);
 	template <typename T, bool code, bool rotate = true> u32 read(u32 address, bool sequential);
 	u8 readIO(u32 address);
 	void writeDebug(u32 address, u8 value, bool unrestricted);
@@ -66,6 +84,20 @@ public:
 	void tickPrefetch(int cycles);
 	bool checkPrefetch(u32 address, bool sequential);
 
+	// Page table for plain memory. Anything with side effects or odd timing has a null pointer and takes the slow path.
+	static constexpr int pageShift = 15; // 32 KiB pages
+	static constexpr u32 pageMask = (1 << pageShift) - 1;
+	struct MemoryPage {
+		u8 *read;
+		u8 *write;
+		u8 cycles[2][2]; // [32 bit][sequential]
+		bool rom; // Uses N/S cycles without touching the prefetch buffer
+		bool byteWrites; // 8 bit writes can use the write pointer
+		bool vram; // Writes have to mark decoded tiles dirty
+	};
+	std::array<MemoryPage, (0x10000000 >> pageShift)> pageTable;
+	void updatePageTable();
+
 	std::stringstream log;
 	bool logFlash;
 
@@ -77,6 +109,7 @@ public:
 		FLASH_128K
 	} saveType;
 	std::filesystem::path saveFilePath;
+	bool useSaveFile; // Turn off to keep instances running the same ROM from sharing a .sav
 	enum {
 		READY = 1 << 0,
 		CMD_1 = 1 << 1,
@@ -124,6 +157,7 @@ public:
 		};
 		u32 InternalMemoryControl; // 0x4xx0800
 	};
+	void updateWaitstates();
 	int sramCycles;
 	int wsNonSequentialCycles[3];
 	int wsSequentialCycles[3];
@@ -4,11 +4,13 @@
 #include "types.hpp"
 
 class GBACPU;
+class StateSerializer;
 class GBABIOS {
 public:
 	GBACPU& cpu;
 
 	GBABIOS(GBACPU& cpu_);
+	void serialize(StateSerializer& state);
 	bool processJump;
 	void jumpToBios();
 
@@ -0,0 +1,46 @@
+#ifndef GBA_MOVIE_HPP
+#define GBA_MOVIE_HPP
+
+#include <filesystem>
+#include <vector>
+
+#include "types.hpp"
+
+// Records every change to KEYINPUT along with the cycle it happened on, so a run can be replayed exactly.
+// Times count from the last reset, so a movie always starts from power on.
+class GameBoyAdvance;
+class GBAMovie {
+public:
+	GameBoyAdvance& bus;
+
+	GBAMovie(GameBoyAdvance& bus_);
+	void reset();
+	void onStateLoaded();
+
+	enum {
+		MOVIE_OFF,
+		MOVIE_RECORDING,
+		MOVIE_PLAYING
+	} mode;
+	struct InputChange {
+		u64 time;
+		u16 keys; // Pressed buttons, 1 = pressed
+	};
+	std::vector<InputChange> inputs; // Sorted by time
+	u64 endTime;
+
+	void startRecording();
+	int stopRecording(std::filesystem::path movieFilePath);
+	int startPlayback(std::filesystem::path movieFilePath);
+	void stop();
+
+	void recordInput(); // Called after the frontend changes KEYINPUT
+	void playInput(); // EVENT_MOVIE_INPUT
+	void scheduleNextInput(u64 after);
+
+	static bool isMovieFile(std::filesystem::path movieFilePath);
+	int saveMovie(std::filesystem::path movieFilePath);
+	int loadMovie(std::filesystem::path movieFilePath);
+};
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <atomic>
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
@@ -11,53 +12,128 @@
 #include "types.hpp"
 
 class GameBoyAdvance;
+class StateSerializer;
 class GBAPPU {
 public:
 	GameBoyAdvance& bus;
+	bool renderOnly; // Only draws lines for the render thread and never touches the scheduler
 
-	GBAPPU(GameBoyAdvance& bus_);
+	GBAPPU(GameBoyAdvance& bus_, bool renderOnly_ = false);
 	void reset();
+	void serialize(StateSerializer& state);
 
-	static void lineStartEvent(void *object);
 	void lineStart();
-	static void hBlankEvent(void *object);
 	void hBlank();
 
 	void calculateWindow();
-	void addPixel(int x, u16 color, int layer, bool semiTransparent);
-	void drawObjects(int priority);
+	void startLayer(int layer);
+	void buildObjectLists();
+	void drawObjects();
 	template <int mode, int size> int calculateTilemapIndex(int x, int y);
 	template <int bgNum> void drawBgTile();
+	void calculateAffineCoords(i32 refX, i32 refY, i16 pa, i16 pc, bool mosaic, int width, int height, bool wrapping);
 	template <int bgNum> void drawBgAffine();
 	template <int mode> void drawBgBitmap();
+	void composeLine();
 	void drawScanline();
+	void incrementAffineRefs();
+
+	// Everything besides memory that drawScanline() reads, so another instance can draw the same line
+	struct LineState {
+		u16 DISPCNT;
+		bool greenSwap;
+		u16 VCOUNT;
+		u16 BG0CNT, BG1CNT, BG2CNT, BG3CNT;
+		u16 BG0HOFS, BG0VOFS, BG1HOFS, BG1VOFS, BG2HOFS, BG2VOFS, BG3HOFS, BG3VOFS;
+		i16 BG2PA, BG2PC, BG3PA, BG3PC;
+		i32 internalBG2X, internalBG2Y, internalBG3X, internalBG3Y;
+		u16 WIN0H, WIN1H, WININ, WINOUT;
+		bool win0VertFits, win1VertFits;
+		u16 MOSAIC;
+		u16 BLDCNT, BLDALPHA, BLDY;
+	};
+	void saveLineState(LineState& line);
+	void loadLineState(const LineState& line);
 
 	u8 readIO(u32 address);
 	void writeIO(u32 address, u8 value);
 
 	int frameCounter;
 	std::atomic<bool> updateScreen;
+	bool skipDraw; // Only keeps internal registers up to date instead of drawing
+
+	// Frame skip
+	static constexpr int frameSkipAuto = -1;
+	static constexpr int maxAutoFrameSkip = 4; // So the screen still moves on a slow machine
+	int frameSkip; // Frames skipped after each drawn one, or frameSkipAuto to skip only when behind
+	bool skipFrame; // Same as skipDraw, but chosen at the start of each frame
+	int framesSkipped; // In a row
+	int forceDrawFrame; // frameCounter of a frame that is drawn even if frameSkip would skip it, or -1
+	std::chrono::steady_clock::time_point nextFrameTime;
+	void chooseFrameSkip();
+
 	uint16_t framebuffer[160][240];
 
-	struct Pixel {
-		int layer;
-		u16 color;
-		u16 oldColor;
-		bool semiTransparent;
-	};
 	bool win0Buffer[240];
 	bool win1Buffer[240];
 	bool winObjBuffer[240];
 	bool winOutBuffer[240];
-	Pixel mergedBuffer[240];
+
+	// BG0-3 and objects each draw into their own line, then composeLine() picks the top two layers of each pixel and blends them.
+	// Keys decide which layer is in front: (priority * 8) + 1 + BG number for BGs, priority * 8 for objects, and 32 for the backdrop.
+	static constexpr u16 transparentKey = 0xFFFF;
+	static constexpr u16 backdropKey = 32;
+	alignas(32) u16 layerColor[5][240];
+	alignas(32) u16 layerKey[5][240];
+	alignas(32) u16 objSemiTransparent[240]; // 0xFFFF where the object in front is semi-transparent
+	alignas(32) u16 windowControl[240]; // Layers and effects enabled at each pixel, same bits as WININ
+	u8 activeLayers; // Layers drawn on this line
+
+	// Objects on each line in OAM order, rebuilt before drawing whenever OAM has changed
+	u8 lineObjects[160][128];
+	u8 lineObjectCount[160];
+	bool objectListsDirty;
+
+	// 32 byte blocks of palette RAM and OAM written since the render thread last copied them
+	u32 paletteDirty;
+	u32 oamDirty;
+	void markPaletteDirty(u32 offset) { paletteDirty |= 1 << (offset >> 5); ++paletteVersion[offset >> 9]; }
+	void markObjectsDirty(u32 offset) { objectListsDirty = true; oamDirty |= 1 << (offset >> 5); ++oamVersion; }
+	void markAllMemoryDirty();
+	void markChangedMemoryDirty(const u8 *newMemory); // Palette RAM, VRAM, and OAM back to back, like in a savestate
+
+	// Bumped on every write, so a line can tell whether anything it reads changed since it was last drawn
+	u64 vramVersion[6]; // 16KB blocks
+	u64 paletteVersion[2]; // BG and OBJ halves
+	u64 oamVersion;
+
+	// Everything a line's pixels depend on. When it matches the last time that line was drawn, the framebuffer already has it.
+	struct LineKey {
+		LineState line;
+		u64 vramVersion[6]; // 0 for blocks the line never reads
+		u64 paletteVersion[2];
+		u64 oamVersion;
+	};
+	LineKey lineKeys[160];
+	bool lineKeyValid[160];
+	u64 linesDrawn;
+	u64 linesReused;
+	void invalidateLines() { memset(lineKeyValid, 0, sizeof(lineKeyValid)); } // For when something else writes to the framebuffer
+	bool lineUnchanged(); // Also remembers this line's key for next time
+	u8 lineVramBlocks();
+
+	// Texel each pixel of an affine or bitmap BG lands on, filled in by calculateAffineCoords()
+	alignas(32) i32 affineX[240];
+	alignas(32) i32 affineY[240];
+	alignas(32) i32 affineVisible[240]; // -1 if inside the BG or wrapped, 0 if clipped
 
 	// Internal registers
 	bool win0VertFits;
 	bool win1VertFits;
-	float internalBG2X;
-	float internalBG2Y;
-	float internalBG3X;
-	float internalBG3Y;
+	i32 internalBG2X; // Reference points in the same 20.8 fixed point as BG2X-BG3Y
+	i32 internalBG2Y;
+	i32 internalBG3X;
+	i32 internalBG3Y;
 
 	struct __attribute__ ((packed)) Object {
 		union {
@@ -118,6 +194,14 @@ public:
 		ObjectMatrix objectMatrices[32];
 	};
 
+	// 4bpp tiles decoded to one byte per pixel, normal and horizontally flipped, indexed by VRAM offset / 32.
+	// Anything that writes to VRAM has to mark the tile dirty so it gets decoded again the next time it's used.
+	u64 tileCache[0x18000 / 32][2][8];
+	u64 tileCacheDirty[0x18000 / 32 / 64];
+	void markTileDirty(u32 offset) { tileCacheDirty[offset >> 11] |= (u64)1 << ((offset >> 5) & 63); ++vramVersion[offset >> 14]; }
+	void markAllTilesDirty() { memset(tileCacheDirty, 0xFF, sizeof(tileCacheDirty)); }
+	const u64 *decodedTile(u32 offset, bool horizontalFlip);
+
 	// MMIO
 	union {
 		struct {
@@ -341,9 +425,6 @@ public:
 		};
 		u16 BLDY; // 0x4000054
 	};
-	float evaCoefficientFloat;
-	float evbCoefficientFloat;
-	float evyCoefficientFloat;
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef PPU_DEBUG_HPP
 #define PPU_DEBUG_HPP
 
+#include <memory>
 #include <string>
 #include "imgui.h"
 #include "backends/imgui_impl_sdl.h"
@@ -11,15 +12,13 @@
 #include "types.hpp"
 #include "gba.hpp"
 
-extern GameBoyAdvance GBA;
-
 void initPpuDebug();
 
 extern bool showLayerView;
-void layerViewWindow();
+void layerViewWindow(GameBoyAdvance& gba);
 extern bool showTiles;
-void tilesWindow();
+void tilesWindow(GameBoyAdvance& gba);
 extern bool showPalette;
-void paletteWindow();
+void paletteWindow(GameBoyAdvance& gba);
 
 #endif
\ No newline at end of file
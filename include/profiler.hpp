@@ -0,0 +1,74 @@
+#ifndef GBA_PROFILER_HPP
+#define GBA_PROFILER_HPP
+
+#include <chrono>
+
+#include "types.hpp"
+
+// Splits wall time between subsystems for --benchmark.
+// Sections nest (a DMA can trigger a scanline, which can trigger another DMA), so time always goes to the innermost one.
+class GBAProfiler {
+public:
+	enum section {
+		PROFILE_CPU, // Everything not covered by another section
+		PROFILE_PPU,
+		PROFILE_APU,
+		PROFILE_DMA,
+		PROFILE_COUNT
+	};
+
+	bool enabled;
+	section currentSection;
+	u64 sectionTime[PROFILE_COUNT]; // Nanoseconds
+
+	GBAProfiler() {
+		enabled = false;
+		clear();
+	}
+
+	void clear() {
+		currentSection = PROFILE_CPU;
+		for (int i = 0; i < PROFILE_COUNT; i++)
+			sectionTime[i] = 0;
+	}
+
+	void start() {
+		clear();
+		lastSwitch = now();
+		enabled = true;
+	}
+
+	void stop() {
+		switchTo(PROFILE_CPU);
+		enabled = false;
+	}
+
+	// Returns the section to hand back to leave()
+	inline section enter(section newSection) {
+		section oldSection = currentSection;
+		if (enabled) [[unlikely]]
+			switchTo(newSection);
+		return oldSection;
+	}
+
+	inline void leave(section oldSection) {
+		if (enabled) [[unlikely]]
+			switchTo(oldSection);
+	}
+
+private:
+	u64 lastSwitch;
+
+	static u64 now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void switchTo(section newSection) {
+		u64 currentTime = now();
+		sectionTime[currentSection] += currentTime - lastSwitch;
+		lastSwitch = currentTime;
+		currentSection = newSection;
+	}
+};
+
+#endif
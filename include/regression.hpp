@@ -0,0 +1,17 @@
+#ifndef REGRESSION_HPP
+#define REGRESSION_HPP
+
+#include <filesystem>
+
+#include "batch.hpp"
+
+// Runs every ROM in a directory in parallel and compares framebuffer and audio hashes at checkpoints against a golden file next to each ROM
+struct RegressionOptions {
+	int frames; // How long new golden files run for
+	int checkpointInterval; // Frames between checkpoints in new golden files
+	bool updateGolden; // Write golden files instead of checking them
+};
+
+int runRegression(std::filesystem::path romDirectory, const RegressionOptions& regressionOptions, const BatchOptions& options);
+
+#endif
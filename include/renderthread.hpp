@@ -0,0 +1,87 @@
+#ifndef GBA_RENDER_THREAD_HPP
+#define GBA_RENDER_THREAD_HPP
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+#include "ppu.hpp"
+#include "threadpool.hpp"
+
+// Draws scanlines off the emulator thread. At each HBlank the emulator thread only queues the PPU registers for that line,
+// along with any 32 byte blocks of VRAM, palette RAM, and OAM written since the last one. Renderers apply those to their
+// own copy of the PPU and draw the line from it, so the result is exactly what drawing in place would give.
+class GameBoyAdvance;
+class GBARenderThread {
+public:
+	GameBoyAdvance& bus;
+
+	GBARenderThread(GameBoyAdvance& bus_);
+	~GBARenderThread();
+
+	enum RenderMode {
+		RENDER_SCANLINE, // Draw in place at each HBlank
+		RENDER_THREAD, // One render thread following a few lines behind
+		RENDER_PARALLEL // Log the whole frame and split it across every core at VBlank
+	};
+	std::atomic<RenderMode> mode; // Set by the frontend, takes effect at the start of the next frame
+	int parallelThreads; // For RENDER_PARALLEL, 0 uses every core
+	RenderMode currentMode;
+	bool running; // Lines are captured instead of drawn
+
+	void update(); // Called by the emulator thread at the start of each frame
+	void captureLine(); // Called by the emulator thread instead of drawScanline()
+	void finish(); // Waits until every captured line is in the framebuffer
+
+private:
+	struct Command {
+		enum : u8 {
+			DRAW_LINE,
+			VRAM,
+			PALETTE,
+			OAM,
+			QUIT
+		} type;
+		u32 offset;
+		union {
+			u8 data[32];
+			GBAPPU::LineState line;
+		};
+	};
+	static void applyCommand(GBAPPU& ppu, const Command& command); // Memory blocks only
+
+	// RENDER_THREAD: single producer, single consumer ring. Only the emulator thread moves writeIndex and only the render thread moves readIndex.
+	static constexpr u32 ringSize = 8192; // Enough for all of VRAM, palette RAM, and OAM at once
+	std::unique_ptr<Command[]> ring;
+	std::atomic<u32> writeIndex;
+	std::atomic<u32> readIndex;
+	u32 nextWrite; // Commands up to here are written but not handed to the render thread yet
+
+	std::unique_ptr<GBAPPU> renderer;
+	std::thread thread;
+
+	// RENDER_PARALLEL: every command since the slowest renderer's position, so any of them can be brought up to the start of its lines.
+	// Each renderer only draws lines from the log, so they all copy on write from the same history instead of sharing memory.
+	struct Chunk {
+		std::unique_ptr<GBAPPU> renderer;
+		size_t position; // Everything in the log before this has been applied
+	};
+	std::vector<Command> commandLog;
+	size_t undrawnStart; // First command that hasn't been drawn
+	std::vector<size_t> undrawnLines; // Where each DRAW_LINE after undrawnStart is
+	std::vector<Chunk> chunks;
+	std::unique_ptr<ThreadPool> pool;
+
+	void start(RenderMode newMode);
+	void stop();
+	Command& newCommand();
+	void publish();
+	void renderLoop();
+	void renderLog();
+	void renderChunk(Chunk& chunk, size_t begin, size_t end);
+	void collectStats(GBAPPU& ppu); // Moves a renderer's line counts to the real PPU
+};
+
+#endif
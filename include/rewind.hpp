@@ -0,0 +1,64 @@
+#ifndef GBA_REWIND_HPP
+#define GBA_REWIND_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+
+// Keeps a savestate of every frame so the game can be played backwards.
+// Only the newest state is stored whole. Each older one is stored as the XOR of itself and the state after it, run length encoded,
+// so stepping back is undoing one delta and the oldest deltas can be dropped whenever the buffer is full.
+class GameBoyAdvance;
+class GBARewind {
+public:
+	GameBoyAdvance& bus;
+
+	GBARewind(GameBoyAdvance& bus_);
+	~GBARewind();
+	void reset(); // Throws away all history
+
+	bool enabled;
+	std::atomic<bool> rewinding; // Held by the frontend
+	size_t bufferSize; // Max bytes of compressed history
+	int lastFrame; // Last frame captureFrame() was called for
+
+	void captureFrame(); // Called by the emulator thread after each frame
+	void stepBack(); // Called by the emulator thread instead of step() while rewinding
+
+	size_t historyFrames();
+	size_t historyBytes();
+
+private:
+	struct Delta {
+		u32 size; // Size of the older state. States aren't all the same length since the sound FIFOs are saved as they are.
+		std::vector<u8> data;
+	};
+
+	// Everything below is shared with the compression thread
+	std::mutex historyMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable workDone;
+	std::deque<Delta> history; // Newest at the back
+	size_t totalBytes;
+	std::vector<u8> newestState;
+	std::deque<std::vector<u8>> pendingStates; // Captured but not compressed yet
+	std::vector<std::vector<u8>> freeBuffers; // Reused so capturing doesn't allocate
+	bool compressing;
+	bool quit;
+	std::thread compressThread;
+	void compressLoop();
+
+	bool captured; // Anything captured since the last reset
+	std::chrono::steady_clock::time_point nextStepTime;
+
+	static void encodeDelta(const std::vector<u8>& older, const std::vector<u8>& newer, Delta& delta);
+	static void applyDelta(std::vector<u8>& state, const Delta& delta);
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SAVESTATE_HPP
+#define SAVESTATE_HPP
+
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "types.hpp"
+
+// Every component lists its state once in serialize(), and the same code both writes and reads it.
+// The format is just those fields back to back in the order they are listed, so bump stateVersion whenever that changes.
+class StateSerializer {
+public:
+	static constexpr u32 stateMagic = 0x53414247; // "GBAS"
+	static constexpr u32 stateVersion = 5;
+
+	bool loading;
+	bool failed; // Set if a load ran past the end of the buffer or loaded a value that can't be right
+
+	StateSerializer(std::vector<u8>& buffer_) : loading(false), failed(false), buffer(&buffer_), loadData(nullptr), loadSize(0), position(0) {
+		buffer->clear(); // Keeps its capacity, so saving every frame doesn't reallocate
+	}
+	StateSerializer(const std::vector<u8>& buffer_) : loading(true), failed(false), buffer(nullptr), loadData(buffer_.data()), loadSize(buffer_.size()), position(0) {}
+
+	template <typename T>
+	void operator()(T& value) {
+		static_assert(std::is_trivially_copyable_v<T>, "Only plain data can be serialized directly");
+		bytes(&value, sizeof(T));
+	}
+
+	void operator()(bool& value) { // Anything but 0 or 1 in a bool is undefined behavior, so check the byte before it becomes one
+		u8 byte = value;
+		bytes(&byte, 1);
+		check(byte <= 1);
+		value = byte & 1;
+	}
+
+	template <size_t N>
+	void operator()(bool (&value)[N]) {
+		for (bool& element : value)
+			(*this)(element);
+	}
+
+	template <typename T>
+	void operator()(std::vector<T>& value) {
+		u32 size = value.size();
+		(*this)(size);
+		if (loading) {
+			if (size > ((loadSize - position) / sizeof(T))) // Don't trust a length for more than what's left
+				failed = true;
+			value.resize(failed ? 0 : size);
+		}
+		bytes(value.data(), value.size() * sizeof(T));
+	}
+
+	void bytes(void *data, size_t size) {
+		if (loading) {
+			if ((position + size) > loadSize) [[unlikely]] {
+				failed = true;
+				return;
+			}
+			memcpy(data, loadData + position, size);
+		} else {
+			buffer->resize(position + size);
+			memcpy(buffer->data() + position, data, size);
+		}
+		position += size;
+	}
+
+	// Components call this after loading anything used as an index or divisor, so a corrupted state can't crash
+	void check(bool valid) {
+		if (loading && !valid)
+			failed = true;
+	}
+
+	size_t size() { return position; }
+	const u8 *peek(size_t size) { return (loading && ((position + size) <= loadSize)) ? (loadData + position) : nullptr; } // What the next load will read, if it's all there
+
+private:
+	std::vector<u8> *buffer;
+	const u8 *loadData;
+	size_t loadSize;
+	size_t position;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Every worker has its own queue and only goes to the others when it runs dry,
+// so a few long jobs don't hold up everything queued behind them on one worker.
+class ThreadPool {
+public:
+	using task = std::function<void(int workerIndex)>;
+
+	ThreadPool(int threadCount = 0); // 0 uses every core
+	~ThreadPool();
+
+	int size() { return (int)workers.size(); }
+	void submit(task newTask);
+	void wait(); // Blocks until every submitted task has finished
+
+private:
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<task> tasks;
+	};
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<unsigned> nextQueue;
+
+	std::mutex stateMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable allDone;
+	int queuedTasks; // Protected by stateMutex
+	int unfinishedTasks; // Protected by stateMutex
+	bool quit;
+
+	bool popTask(int workerIndex, task& out);
+	void workerLoop(int workerIndex);
+};
+
+#endif
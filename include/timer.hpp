@@ -5,15 +5,17 @@
 #include "types.hpp"
 
 class GameBoyAdvance;
+class StateSerializer;
 class GBATIMER {
 public:
 	GameBoyAdvance& bus;
 
 	GBATIMER(GameBoyAdvance& bus_);
 	void reset();
+	void serialize(StateSerializer& state);
 
-	static void checkOverflowEvent(void *object);
 	void checkOverflow();
+	template <int timer> void scheduleOverflow();
 
 	template <int timer> u64 getDValue();
 
@@ -6,6 +6,7 @@
 
 GBAAPU::GBAAPU(GameBoyAdvance& bus_) : bus(bus_) {
 	ch1OverrideEnable = ch2OverrideEnable = ch3OverrideEnable = ch4OverrideEnable = chAOverrideEnable = chBOverrideEnable = true;
+	discardSamples = false;
 
 	reset();
 }
@@ -35,12 +36,76 @@ void GBAAPU::reset() {
 	channelB.fifo = {};
 	channelB.currentSample = 0;
 
-	bus.cpu.addEvent(16777216 / 32768, sampleEvent, this);
-	bus.cpu.addEvent(8192 * 4, frameSequencerEvent, this);
+	bus.cpu.reschedule(GBACPU::EVENT_APU_SAMPLE, bus.cpu.currentTime + (16777216 / 32768));
+	bus.cpu.reschedule(GBACPU::EVENT_APU_FRAME_SEQUENCER, bus.cpu.currentTime + (8192 * 4));
 	sampleBufferIndex = 0;
 	apuBlock = false;
 }
 
+void GBAAPU::serialize(StateSerializer& state) {
+	state(frameSequencerCounter);
+	// Channel structs have padding, so go field by field to keep states byte for byte reproducible
+	state(channel1.SOUND1CNT_L);
+	state(channel1.SOUND1CNT_H);
+	state(channel1.SOUND1CNT_X);
+	state(channel1.frequencyTimer);
+	state(channel1.waveIndex);
+	state.check(channel1.waveIndex < 8);
+	state(channel1.sweepEnabled);
+	state(channel1.shadowFrequency);
+	state(channel1.sweepTimer);
+	state(channel1.lengthCounter);
+	state(channel1.periodTimer);
+	state(channel1.currentVolume);
+
+	state(channel2.SOUND2CNT_L);
+	state(channel2.SOUND2CNT_H);
+	state(channel2.frequencyTimer);
+	state(channel2.waveIndex);
+	state.check(channel2.waveIndex < 8);
+	state(channel2.lengthCounter);
+	state(channel2.periodTimer);
+	state(channel2.currentVolume);
+
+	state(channel3.SOUND3CNT_L);
+	state(channel3.SOUND3CNT_H);
+	state(channel3.SOUND3CNT_X);
+	state(channel3.waveMem);
+	state(channel3.waveMemIndex);
+	state.check(channel3.waveMemIndex < sizeof(channel3.waveMem));
+	state(channel3.frequencyTimer);
+	state(channel3.lengthCounter);
+
+	state(channel4.SOUND4CNT_L);
+	state(channel4.SOUND4CNT_H);
+	state(channel4.frequencyTimer);
+	state(channel4.lfsr);
+	state(channel4.lengthCounter);
+	state(channel4.periodTimer);
+	state(channel4.currentVolume);
+
+	state(soundControl);
+
+	for (auto *channel : {&channelA.fifo, &channelB.fifo}) {
+		std::vector<i8> fifoContents;
+		if (!state.loading) {
+			for (auto fifoCopy = *channel; !fifoCopy.empty(); fifoCopy.pop())
+				fifoContents.push_back(fifoCopy.front());
+		}
+
+		state(fifoContents);
+		state.check(fifoContents.size() <= 32);
+
+		if (state.loading) {
+			*channel = {};
+			for (i8 sample : fifoContents)
+				channel->push(sample);
+		}
+	}
+	state(channelA.currentSample);
+	state(channelB.currentSample);
+}
+
 static const float squareWaveDutyCycles[4][8] {
 	{1, 0, 0, 0, 0, 0, 0, 0}, // 12.5%
 	{1, 1, 0, 0, 0, 0, 0, 0}, // 25%
@@ -48,10 +113,6 @@ static const float squareWaveDutyCycles[4][8] {
 	{1, 1, 1, 1, 1, 1, 0, 0}  // 75%
 };
 
-void GBAAPU::frameSequencerEvent(void *object) {
-	static_cast<GBAAPU *>(object)->tickFrameSequencer();
-}
-
 int GBAAPU::calculateSweepFrequency() {
 	int newFrequency = channel1.shadowFrequency >> channel1.sweepShift;
 
@@ -164,17 +225,11 @@ void GBAAPU::tickFrameSequencer() {
 		}
 	}
 
-	bus.cpu.addEvent(8192 * 4, frameSequencerEvent, this);
-}
-
-void GBAAPU::sampleEvent(void *object) {
-	static_cast<GBAAPU *>(object)->generateSample();
+	bus.cpu.reschedule(GBACPU::EVENT_APU_FRAME_SEQUENCER, bus.cpu.currentTime + (8192 * 4));
 }
 
 void GBAAPU::generateSample() {
-	bus.cpu.addEvent(16777216 / 32768, sampleEvent, this, ((sampleBufferIndex + 4) >= sampleBuffer.size()));
-	if (apuBlock)
-		return;
+	bus.cpu.reschedule(GBACPU::EVENT_APU_SAMPLE, bus.cpu.currentTime + (16777216 / 32768), ((sampleBufferIndex + 4) >= sampleBuffer.size()));
 	sampleBufferMutex.lock();
 
 	// Tick old GB channels
@@ -209,6 +264,12 @@ void GBAAPU::generateSample() {
 		}
 	}
 
+	// Keep the channels ticking while the buffer is full so the emulated state never depends on how fast samples are consumed
+	if (apuBlock || discardSamples) {
+		sampleBufferMutex.unlock();
+		return;
+	}
+
 	float ch1Sample = ch1OverrideEnable * soundControl.ch1On * (((channel1.currentVolume * squareWaveDutyCycles[channel1.waveDuty][channel1.waveIndex]) / 7.5) - 1.0f) * ((float)(soundControl.psgVolume + 1) / 4);
 	i16 ch1SampleR = ch1Sample * soundControl.ch1outR * soundControl.volumeFloatR * 0x7F;
 	i16 ch1SampleL = ch1Sample * soundControl.ch1outL * soundControl.volumeFloatL * 0x7F;
@@ -240,8 +301,13 @@ void GBAAPU::generateSample() {
 		sampleBuffer[sampleBufferIndex++] = ((soundControl.biasLevel << 6) | (soundControl.biasLevel >> 4)) - 0x8000;
 	}
 
-	if (sampleBufferIndex == sampleBuffer.size())
-		apuBlock = true;
+	if (sampleBufferIndex == sampleBuffer.size()) {
+		if (onBufferFull) {
+			onBufferFull();
+		} else {
+			apuBlock = true;
+		}
+	}
 
 	sampleBufferMutex.unlock();
 }
@@ -9,6 +9,7 @@
 #define iCycle(x) bus.internalCycle(x)
 
 ARM7TDMI::ARM7TDMI(GameBoyAdvance& bus_) : bus(bus_) {
+	instructionsExecuted = 0;
 	//resetARM7TDMI();
 }
 
@@ -33,6 +34,7 @@ void ARM7TDMI::resetARM7TDMI() {
 	reg.R[15] = 0;//0x08000000; // Start of ROM
 
 	reg.CPSR = 0x000000DF;
+	flagOp = FLAGS_IN_CPSR;
 
 	reg.R8_user = reg.R9_user = reg.R10_user = reg.R11_user = reg.R12_user = reg.R13_user = reg.R14_user = 0;
 	reg.R8_fiq = reg.R9_fiq = reg.R10_fiq = reg.R11_fiq = reg.R12_fiq = reg.R13_fiq = reg.R14_fiq = reg.SPSR_fiq = 0;
@@ -52,6 +54,7 @@ void ARM7TDMI::cycle() {
 	if (processIrq) { [[unlikely]] // Service interrupt
 		serviceInterrupt();
 	} else {
+		++instructionsExecuted;
 		if (reg.thumbMode) {
 			u16 lutIndex = pipelineOpcode3 >> 6;
 			(this->*thumbLUT[lutIndex])((u16)pipelineOpcode3);
@@ -73,20 +76,20 @@ void ARM7TDMI::cycle() {
 
 bool ARM7TDMI::checkCondition(int conditionCode) {
 	switch (conditionCode) {
-	case 0x0: return reg.flagZ;
-	case 0x1: return !reg.flagZ;
-	case 0x2: return reg.flagC;
-	case 0x3: return !reg.flagC;
-	case 0x4: return reg.flagN;
-	case 0x5: return !reg.flagN;
-	case 0x6: return reg.flagV;
-	case 0x7: return !reg.flagV;
-	case 0x8: return reg.flagC && !reg.flagZ;
-	case 0x9: return !reg.flagC || reg.flagZ;
-	case 0xA: return reg.flagN == reg.flagV;
-	case 0xB: return reg.flagN != reg.flagV;
-	case 0xC: return !reg.flagZ && (reg.flagN == reg.flagV);
-	case 0xD: return reg.flagZ || (reg.flagN != reg.flagV);
+	case 0x0: return getFlagZ();
+	case 0x1: return !getFlagZ();
+	case 0x2: return getFlagC();
+	case 0x3: return !getFlagC();
+	case 0x4: return getFlagN();
+	case 0x5: return !getFlagN();
+	case 0x6: return getFlagV();
+	case 0x7: return !getFlagV();
+	case 0x8: return getFlagC() && !getFlagZ();
+	case 0x9: return !getFlagC() || getFlagZ();
+	case 0xA: return getFlagN() == getFlagV();
+	case 0xB: return getFlagN() != getFlagV();
+	case 0xC: return !getFlagZ() && (getFlagN() == getFlagV());
+	case 0xD: return getFlagZ() || (getFlagN() != getFlagV());
 	case 0xE: [[likely]] return true;
 	case 0xF: [[unlikely]] return true;
 	default:
@@ -95,6 +98,17 @@ bool ARM7TDMI::checkCondition(int conditionCode) {
 	}
 }
 
+u32 ARM7TDMI::readCPSR() const {
+	return (reg.CPSR & 0x0FFFFFFF) | (getFlagN() << 31) | (getFlagZ() << 30) | (getFlagC() << 29) | (getFlagV() << 28);
+}
+
+void ARM7TDMI::materializeFlags() {
+	if (flagOp != FLAGS_IN_CPSR) {
+		reg.CPSR = readCPSR();
+		flagOp = FLAGS_IN_CPSR;
+	}
+}
+
 void ARM7TDMI::serviceInterrupt() {
 	processIrq = false;
 
@@ -144,6 +158,29 @@ void ARM7TDMI::flushPipeline() {
 	nextFetchType = true;
 }
 
+void ARM7TDMI::serialize(StateSerializer& state) {
+	state(reg);
+	switch (reg.mode) { // Banking indexes on the mode, so it has to be one that exists
+	case MODE_USER: case MODE_FIQ: case MODE_IRQ: case MODE_SUPERVISOR: case MODE_ABORT: case MODE_UNDEFINED: case MODE_SYSTEM: break;
+	default: state.check(false); break;
+	}
+	state(flagOp); // Flags are saved lazy, the same way they're stored
+	state.check(flagOp <= FLAGS_SUB);
+	state(flagResult);
+	state(flagOperand1);
+	state(flagOperand2);
+	state(flagCarry);
+	state(flagOverflow);
+
+	state(processIrq);
+	state(pipelineOpcode1);
+	state(pipelineOpcode2);
+	state(pipelineOpcode3);
+	state(nextFetchType);
+	if (reg.thumbMode) // Thumb opcodes index thumbLUT
+		state.check(((pipelineOpcode1 | pipelineOpcode2 | pipelineOpcode3) >> 16) == 0);
+}
+
 /* Instruction Decoding/Executing */
 static const u32 armDataProcessingMask = 0b1100'0000'0000;
 static const u32 armDataProcessingBits = 0b0000'0000'0000;
@@ -217,7 +254,7 @@ void ARM7TDMI::unknownOpcodeArm(u32 opcode) {
 }
 
 void ARM7TDMI::unknownOpcodeArm(u32 opcode, std::string message) {
-	bus.cpu.addEvent(1, bus.cpu.stopEvent, this);
+	bus.cpu.reschedule(GBACPU::EVENT_STOP, bus.cpu.currentTime + 1);
 	bus.log << fmt::format("Unknown ARM opcode 0x{:0>8X} at address 0x{:0>7X}  Message: {}\n", opcode, reg.R[15] - 8, message.c_str());
 }
 
@@ -226,7 +263,7 @@ void ARM7TDMI::unknownOpcodeThumb(u16 opcode) {
 }
 
 void ARM7TDMI::unknownOpcodeThumb(u16 opcode, std::string message) {
-	bus.cpu.addEvent(1, bus.cpu.stopEvent, this);
+	bus.cpu.reschedule(GBACPU::EVENT_STOP, bus.cpu.currentTime + 1);
 	bus.log << fmt::format("Unknown THUMB opcode 0x{:0>4X} at address 0x{:0>7X}  Message: {}\n", opcode, reg.R[15] - 4, message.c_str());
 }
 
@@ -242,7 +279,7 @@ bool ARM7TDMI::computeShift(u32 opcode, u32 *result) {
 		shiftOperand = opcode & 0xFF;
 		shiftAmount = (opcode & (0xF << 8)) >> 7;
 		if (shiftAmount == 0) {
-			shifterCarry = reg.flagC;
+			shifterCarry = getFlagC();
 		} else {
 			shifterCarry = shiftOperand & (1 << (shiftAmount - 1));
 			shiftOperand = (shiftOperand >> shiftAmount) | (shiftOperand << (32 - shiftAmount));
@@ -256,7 +293,7 @@ bool ARM7TDMI::computeShift(u32 opcode, u32 *result) {
 		shiftOperand = reg.R[opcode & 0xF];
 
 		if ((opcode & (1 << 4)) && (shiftAmount == 0)) {
-			shifterCarry = reg.flagC;
+			shifterCarry = getFlagC();
 		} else {
 			switch ((opcode >> 5) & 3) {
 			case 0: // LSL
@@ -269,7 +306,7 @@ bool ARM7TDMI::computeShift(u32 opcode, u32 *result) {
 					shifterCarry = shiftOperand & (1 << (31 - (shiftAmount - 1)));
 					shiftOperand <<= shiftAmount;
 				} else {
-					shifterCarry = reg.flagC;
+					shifterCarry = getFlagC();
 				}
 				break;
 			case 1: // LSR
@@ -301,7 +338,7 @@ bool ARM7TDMI::computeShift(u32 opcode, u32 *result) {
 			case 3: // ROR
 				if (opcode & (1 << 4)) { // Using register as shift amount
 					if (shiftAmount == 0) {
-						shifterCarry = reg.flagC;
+						shifterCarry = getFlagC();
 						break;
 					}
 					shiftAmount &= 31;
@@ -312,7 +349,7 @@ bool ARM7TDMI::computeShift(u32 opcode, u32 *result) {
 				} else {
 					if (shiftAmount == 0) { // RRX
 						shifterCarry = shiftOperand & 1;
-						shiftOperand = (shiftOperand >> 1) | (reg.flagC << 31);
+						shiftOperand = (shiftOperand >> 1) | (getFlagC() << 31);
 						break;
 					}
 				}
@@ -332,6 +369,9 @@ template bool ARM7TDMI::computeShift<true, false>(u32, u32*);
 template bool ARM7TDMI::computeShift<true, true>(u32, u32*);
 
 void ARM7TDMI::bankRegisters(cpuMode newMode, bool enterMode) {
+	if (enterMode)
+		materializeFlags();
+
 	if (reg.mode != MODE_FIQ) {
 		reg.R8_user = reg.R[8];
 		reg.R9_user = reg.R[9];
@@ -433,6 +473,7 @@ void ARM7TDMI::bankRegisters(cpuMode newMode, bool enterMode) {
 }
 
 void ARM7TDMI::leaveMode() {
+	materializeFlags();
 	u32 tmpPSR = reg.CPSR;
 	switch (reg.mode) {
 	case MODE_FIQ: tmpPSR = reg.SPSR_fiq; break;
@@ -458,8 +499,8 @@ void ARM7TDMI::dataProcessing(u32 opcode) {
 	bool shifterCarry = computeShift<false, iBit>(opcode, &operand2);
 
 	// Perform operation
-	bool operationCarry = reg.flagC;
-	bool operationOverflow = reg.flagV;
+	bool operationCarry = false;
+	bool operationOverflow = false;
 	operand1 = reg.R[(opcode >> 16) & 0xF];
 	u32 result = 0;
 	auto destinationReg = (opcode & (0xF << 12)) >> 12;
@@ -471,35 +512,32 @@ void ARM7TDMI::dataProcessing(u32 opcode) {
 		result = operand1 ^ operand2;
 		break;
 	case 0x2: // SUB
-		operationCarry = operand1 >= operand2;
 		result = operand1 - operand2;
-		operationOverflow = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 		break;
 	case 0x3: // RSB
-		operationCarry = operand2 >= operand1;
 		result = operand2 - operand1;
-		operationOverflow = ((operand2 ^ operand1) & ((operand2 ^ result)) & 0x80000000) > 0;
 		break;
 	case 0x4: // ADD
-		operationCarry = ((u64)operand1 + (u64)operand2) >> 32;
 		result = operand1 + operand2;
-		operationOverflow = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 		break;
-	case 0x5: // ADC
-		operationCarry = ((u64)operand1 + (u64)operand2 + reg.flagC) >> 32;
-		result = operand1 + operand2 + reg.flagC;
+	case 0x5: { // ADC
+		bool carry = getFlagC();
+		operationCarry = ((u64)operand1 + (u64)operand2 + carry) >> 32;
+		result = operand1 + operand2 + carry;
 		operationOverflow = (~(operand1 ^ operand2) & ((operand1 ^ result))) >> 31;
-		break;
-	case 0x6: // SBC
-		operationCarry = (u64)operand1 >= ((u64)operand2 + !reg.flagC);
-		result = (u64)operand1 - ((u64)operand2 + !reg.flagC);
+		} break;
+	case 0x6: { // SBC
+		bool carry = getFlagC();
+		operationCarry = (u64)operand1 >= ((u64)operand2 + !carry);
+		result = (u64)operand1 - ((u64)operand2 + !carry);
 		operationOverflow = ((operand1 ^ operand2) & (operand1 ^ result)) >> 31;
-		break;
-	case 0x7: // RSC
-		operationCarry = (u64)operand2 >= ((u64)operand1 + !reg.flagC);
-		result = (u64)operand2 - ((u64)operand1 + !reg.flagC);
+		} break;
+	case 0x7: { // RSC
+		bool carry = getFlagC();
+		operationCarry = (u64)operand2 >= ((u64)operand1 + !carry);
+		result = (u64)operand2 - ((u64)operand1 + !carry);
 		operationOverflow = ((operand2 ^ operand1) & (operand2 ^ result)) >> 31;
-		break;
+		} break;
 	case 0x8: // TST
 		result = operand1 & operand2;
 		break;
@@ -507,14 +545,10 @@ void ARM7TDMI::dataProcessing(u32 opcode) {
 		result = operand1 ^ operand2;
 		break;
 	case 0xA: // CMP
-		operationCarry = operand1 >= operand2;
 		result = operand1 - operand2;
-		operationOverflow = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 		break;
 	case 0xB: // CMN
-		operationCarry = ((u64)operand1 + (u64)operand2) >> 32;
 		result = operand1 + operand2;
-		operationOverflow = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 		break;
 	case 0xC: // ORR
 		result = operand1 | operand2;
@@ -530,15 +564,18 @@ void ARM7TDMI::dataProcessing(u32 opcode) {
 		break;
 	}
 
-	// Compute common flags
+	// Record flags
 	if constexpr (sBit) {
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
-		if ((operation < 2) || (operation == 8) || (operation == 9) || (operation >= 0xC)) { // Logical operations
-			reg.flagC = shifterCarry;
+		if constexpr ((operation < 2) || (operation == 8) || (operation == 9) || (operation >= 0xC)) { // Logical operations
+			setFlagsLogical(result, shifterCarry);
+		} else if constexpr ((operation == 0x2) || (operation == 0xA)) { // SUB, CMP
+			setFlagsSub(operand1, operand2, result);
+		} else if constexpr (operation == 0x3) { // RSB
+			setFlagsSub(operand2, operand1, result);
+		} else if constexpr ((operation == 0x4) || (operation == 0xB)) { // ADD, CMN
+			setFlagsAdd(operand1, operand2, result);
 		} else {
-			reg.flagC = operationCarry;
-			reg.flagV = operationOverflow;
+			setFlags(result, operationCarry, operationOverflow);
 		}
 	}
 
@@ -575,10 +612,8 @@ void ARM7TDMI::multiply(u32 opcode) {
 		iCycle(1);
 	}
 	reg.R[destinationReg] = result;
-	if constexpr (sBit) {
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
-	}
+	if constexpr (sBit)
+		setFlagsLogical(result, getFlagC());
 
 	int multiplierCycles = ((31 - std::max(std::countl_zero(multiplier), std::countl_one(multiplier))) / 8) + 1;
 	iCycle(multiplierCycles);
@@ -612,6 +647,7 @@ void ARM7TDMI::multiplyLong(u32 opcode) {
 		iCycle(1);
 	}
 	if constexpr (sBit) {
+		materializeFlags();
 		reg.flagN = result >> 63;
 		reg.flagZ = result == 0;
 	}
@@ -656,6 +692,7 @@ void ARM7TDMI::singleDataSwap(u32 opcode) {
 
 template <bool targetPSR> void ARM7TDMI::psrLoad(u32 opcode) {
 	u32 destinationReg = (opcode >> 12) & 0xF;
+	materializeFlags();
 
 	if constexpr (targetPSR) {
 		switch (reg.mode) {
@@ -687,6 +724,7 @@ template <bool targetPSR> void ARM7TDMI::psrStoreReg(u32 opcode) {
 		default: fetchOpcode(); return;
 		}
 	} else {
+		materializeFlags();
 		target = &reg.CPSR;
 	}
 
@@ -724,6 +762,7 @@ template <bool targetPSR> void ARM7TDMI::psrStoreImmediate(u32 opcode) {
 		default: fetchOpcode(); return;
 		}
 	} else {
+		materializeFlags();
 		target = &reg.CPSR;
 	}
 
@@ -988,6 +1027,7 @@ void ARM7TDMI::blockDataTransfer(u32 opcode) {
 
 template <bool lBit>
 void ARM7TDMI::branch(u32 opcode) {
+	u32 branchAddress = reg.R[15] - 8;
 	u32 address = reg.R[15] + (((i32)((opcode & 0x00FFFFFF) << 8)) >> 6);
 	fetchOpcode();
 
@@ -995,6 +1035,11 @@ void ARM7TDMI::branch(u32 opcode) {
 		reg.R[14] = reg.R[15] - 8;
 	reg.R[15] = address;
 	flushPipeline();
+
+	if constexpr (!lBit) {
+		if ((branchAddress - address) <= GBACPU::maxIdleLoopSize)
+			bus.cpu.checkIdleLoop(branchAddress);
+	}
 }
 
 void ARM7TDMI::softwareInterrupt(u32 opcode) { // TODO: Proper timings for exceptions
@@ -1056,25 +1101,26 @@ constexpr std::array<lutEntry, 4096> ARM7TDMI::LUT = {
 template <int op, int shiftAmount>
 void ARM7TDMI::thumbMoveShiftedReg(u16 opcode) {
 	u32 shiftOperand = reg.R[(opcode >> 3) & 7];
+	bool carry = getFlagC();
 
 	switch (op) {
 	case 0: // LSL
 		if (shiftAmount != 0) {
 			if (shiftAmount > 31) {
-				reg.flagC = (shiftAmount == 32) ? (shiftOperand & 1) : 0;
+				carry = (shiftAmount == 32) ? (shiftOperand & 1) : 0;
 				shiftOperand = 0;
 				break;
 			}
-			reg.flagC = (bool)(shiftOperand & (1 << (31 - (shiftAmount - 1))));
+			carry = (bool)(shiftOperand & (1 << (31 - (shiftAmount - 1))));
 			shiftOperand <<= shiftAmount;
 		}
 		break;
 	case 1: // LSR
 		if (shiftAmount == 0) {
-			reg.flagC = shiftOperand >> 31;
+			carry = shiftOperand >> 31;
 			shiftOperand = 0;
 		} else {
-			reg.flagC = (shiftOperand >> (shiftAmount - 1)) & 1;
+			carry = (shiftOperand >> (shiftAmount - 1)) & 1;
 			shiftOperand = shiftOperand >> shiftAmount;
 		}
 		break;
@@ -1082,20 +1128,19 @@ void ARM7TDMI::thumbMoveShiftedReg(u16 opcode) {
 		if (shiftAmount == 0) {
 			if (shiftOperand & (1 << 31)) {
 				shiftOperand = 0xFFFFFFFF;
-				reg.flagC = true;
+				carry = true;
 			} else {
 				shiftOperand = 0;
-				reg.flagC = false;
+				carry = false;
 			}
 		} else {
-			reg.flagC = (shiftOperand >> (shiftAmount - 1)) & 1;
+			carry = (shiftOperand >> (shiftAmount - 1)) & 1;
 			shiftOperand = ((i32)shiftOperand) >> shiftAmount;
 		}
 		break;
 	}
 
-	reg.flagN = shiftOperand >> 31;
-	reg.flagZ = shiftOperand == 0;
+	setFlagsLogical(shiftOperand, carry);
 	reg.R[opcode & 7] = shiftOperand;
 	fetchOpcode();
 }
@@ -1107,17 +1152,11 @@ void ARM7TDMI::thumbAddSubtract(u16 opcode) {
 
 	u32 result;
 	if (op) { // SUB
-		reg.flagC = operand1 >= operand2;
 		result = operand1 - operand2;
-		reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
+		setFlagsSub(operand1, operand2, result);
 	} else { // ADD
-		reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 		result = operand1 + operand2;
-		reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
+		setFlagsAdd(operand1, operand2, result);
 	}
 
 	reg.R[opcode & 7] = result;
@@ -1133,26 +1172,22 @@ void ARM7TDMI::thumbAluImmediate(u16 opcode) {
 	switch (op) {
 	case 0: // MOV
 		result = operand2;
+		setFlagsLogical(result, getFlagC());
 		break;
 	case 1: // CMP
-		reg.flagC = operand1 >= operand2;
 		result = operand1 - operand2;
-		reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+		setFlagsSub(operand1, operand2, result);
 		break;
 	case 2: // ADD
-		reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 		result = operand1 + operand2;
-		reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+		setFlagsAdd(operand1, operand2, result);
 		break;
 	case 3: // SUB
-		reg.flagC = operand1 >= operand2;
 		result = operand1 - operand2;
-		reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
+		setFlagsSub(operand1, operand2, result);
 		break;
 	}
 
-	reg.flagN = result >> 31;
-	reg.flagZ = result == 0;
 	if constexpr (op != 1)
 		reg.R[destinationReg] = result;
 	fetchOpcode();
@@ -1168,6 +1203,8 @@ void ARM7TDMI::thumbAluReg(u16 opcode) {
 	constexpr bool endWithIdle = ((op == 0x2) || (op == 0x3) || (op == 0x4) || (op == 0x7) || (op == 0xD));
 
 	u32 result;
+	bool carry = getFlagC();
+	bool overflow = getFlagV();
 	switch (op) {
 	case 0x0: // AND
 		result = operand1 & operand2;
@@ -1180,10 +1217,10 @@ void ARM7TDMI::thumbAluReg(u16 opcode) {
 			result = operand1;
 		} else {
 			if (operand2 > 31) {
-				reg.flagC = (operand2 == 32) ? (operand1 & 1) : 0;
+				carry = (operand2 == 32) ? (operand1 & 1) : 0;
 				result = 0;
 			} else {
-				reg.flagC = (operand1 & (1 << (31 - (operand2 - 1)))) > 0;
+				carry = (operand1 & (1 << (31 - (operand2 - 1)))) > 0;
 				result = operand1 << operand2;
 			}
 		}
@@ -1194,12 +1231,12 @@ void ARM7TDMI::thumbAluReg(u16 opcode) {
 			result = operand1;
 		} else if (operand2 == 32) {
 			result = 0;
-			reg.flagC = operand1 >> 31;
+			carry = operand1 >> 31;
 		} else if (operand2 > 32) {
 			result = 0;
-			reg.flagC = false;
+			carry = false;
 		} else {
-			reg.flagC = (operand1 >> (operand2 - 1)) & 1;
+			carry = (operand1 >> (operand2 - 1)) & 1;
 			result = operand1 >> operand2;
 		}
 		fetchOpcode();
@@ -1210,26 +1247,26 @@ void ARM7TDMI::thumbAluReg(u16 opcode) {
 		} else if (operand2 > 31) {
 			if (operand1 & (1 << 31)) {
 				result = 0xFFFFFFFF;
-				reg.flagC = true;
+				carry = true;
 			} else {
 				result = 0;
-				reg.flagC = false;
+				carry = false;
 			}
 		} else {
-			reg.flagC = (operand1 >> (operand2 - 1)) & 1;
+			carry = (operand1 >> (operand2 - 1)) & 1;
 			result = ((i32)operand1) >> operand2;
 		}
 		fetchOpcode();
 		break;
 	case 0x5: // ADC
-		result = operand1 + operand2 + reg.flagC;
-		reg.flagC = ((u64)operand1 + (u64)operand2 + reg.flagC) >> 32;
-		reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result))) >> 31;
+		result = operand1 + operand2 + carry;
+		carry = ((u64)operand1 + (u64)operand2 + carry) >> 32;
+		overflow = (~(operand1 ^ operand2) & ((operand1 ^ result))) >> 31;
 		break;
 	case 0x6: // SBC
-		result = (u64)operand1 - ((u64)operand2 + !reg.flagC);
-		reg.flagC = (u64)operand1 >= ((u64)operand2 + !reg.flagC);
-		reg.flagV = ((operand1 ^ operand2) & (operand1 ^ result)) >> 31;
+		result = (u64)operand1 - ((u64)operand2 + !carry);
+		carry = (u64)operand1 >= ((u64)operand2 + !carry);
+		overflow = ((operand1 ^ operand2) & (operand1 ^ result)) >> 31;
 		break;
 	case 0x7: // ROR
 		if (operand2 == 0) {
@@ -1237,10 +1274,10 @@ void ARM7TDMI::thumbAluReg(u16 opcode) {
 		} else {
 			operand2 &= 31;
 			if (operand2 == 0) {
-				reg.flagC = operand1 >> 31;
+				carry = operand1 >> 31;
 				result = operand1;
 			} else {
-				reg.flagC = (bool)(operand1 & (1 << (operand2 - 1)));
+				carry = (bool)(operand1 & (1 << (operand2 - 1)));
 				result = (operand1 >> operand2) | (operand1 << (32 - operand2));
 			}
 		}
@@ -1250,19 +1287,13 @@ void ARM7TDMI::thumbAluReg(u16 opcode) {
 		result = operand1 & operand2;
 		break;
 	case 0x9: // NEG
-		reg.flagC = 0 >= operand2;
 		result = 0 - operand2;
-		reg.flagV = (operand2 & result & 0x80000000) > 0;
 		break;
 	case 0xA: // CMP
-		reg.flagC = operand1 >= operand2;
 		result = operand1 - operand2;
-		reg.flagV = ((operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 		break;
 	case 0xB: // CMN
-		reg.flagC = ((u64)operand1 + (u64)operand2) >> 32;
 		result = operand1 + operand2;
-		reg.flagV = (~(operand1 ^ operand2) & ((operand1 ^ result)) & 0x80000000) > 0;
 		break;
 	case 0xC: // ORR
 		result = operand1 | operand2;
@@ -1281,9 +1312,16 @@ void ARM7TDMI::thumbAluReg(u16 opcode) {
 		break;
 	}
 
-	// Compute common flags
-	reg.flagN = result >> 31;
-	reg.flagZ = result == 0;
+	// Record flags
+	if constexpr (op == 0x9) { // NEG
+		setFlagsSub(0, operand2, result);
+	} else if constexpr (op == 0xA) { // CMP
+		setFlagsSub(operand1, operand2, result);
+	} else if constexpr (op == 0xB) { // CMN
+		setFlagsAdd(operand1, operand2, result);
+	} else {
+		setFlags(result, carry, overflow);
+	}
 
 	if constexpr (writeResult)
 		reg.R[destinationReg] = result;
@@ -1305,11 +1343,8 @@ void ARM7TDMI::thumbHighRegOperation(u16 opcode) {
 		result = reg.R[operand1] + reg.R[operand2];
 		break;
 	case 1: // CMP
-		reg.flagC = reg.R[operand1] >= reg.R[operand2];
 		result = reg.R[operand1] - reg.R[operand2];
-		reg.flagV = ((reg.R[operand1] ^ reg.R[operand2]) & ((reg.R[operand1] ^ result)) & 0x80000000) > 0;
-		reg.flagN = result >> 31;
-		reg.flagZ = result == 0;
+		setFlagsSub(reg.R[operand1], reg.R[operand2], result);
 		break;
 	case 2: // MOV
 		result = reg.R[operand2];
@@ -1592,12 +1627,16 @@ void ARM7TDMI::thumbMultipleLoadStore(u16 opcode) {
 
 template <int condition>
 void ARM7TDMI::thumbConditionalBranch(u16 opcode) {
+	u32 branchAddress = reg.R[15] - 4;
 	u32 newAddress = reg.R[15] + ((i16)(opcode << 8) >> 7);
 	fetchOpcode();
 
 	if (checkCondition(condition)) {
 		reg.R[15] = newAddress;
 		flushPipeline();
+
+		if ((branchAddress - newAddress) <= GBACPU::maxIdleLoopSize)
+			bus.cpu.checkIdleLoop(branchAddress);
 	}
 }
 
@@ -1611,11 +1650,15 @@ void ARM7TDMI::thumbSoftwareInterrupt(u16 opcode) {
 }
 
 void ARM7TDMI::thumbUnconditionalBranch(u16 opcode) {
+	u32 branchAddress = reg.R[15] - 4;
 	u32 newAddress = reg.R[15] + ((i16)(opcode << 5) >> 4);
 	fetchOpcode();
 
 	reg.R[15] = newAddress;
 	flushPipeline();
+
+	if ((branchAddress - newAddress) <= GBACPU::maxIdleLoopSize)
+		bus.cpu.checkIdleLoop(branchAddress);
 }
 
 template <bool lowHigh>
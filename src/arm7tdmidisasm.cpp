@@ -771,5 +771,3 @@ void ARM7TDMIDisassembler::defaultSettings() {
 	options.simplifyPushPop = false;
 	options.ldmStmStackSuffixes = false;
 }
-
-ARM7TDMIDisassembler disassembler;
\ No newline at end of file
@@ -0,0 +1,202 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "batch.hpp"
+#include "gba.hpp"
+#include "threadpool.hpp"
+#include "types.hpp"
+
+u64 fnv1a(const void *data, size_t size, u64 hash) {
+	const u8 *bytes = (const u8 *)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3;
+	}
+
+	return hash;
+}
+
+int loadBatchManifest(std::filesystem::path manifestFilePath, std::vector<BatchJob>& jobs) {
+	// One job per line: <rom> <frames> [input file]
+	// Relative paths are relative to the manifest. Blank lines and lines starting with # are skipped.
+	std::ifstream manifestFileStream{manifestFilePath};
+	if (!manifestFileStream.is_open()) {
+		printf("Failed to open manifest file: %s\n", manifestFilePath.c_str());
+		return -1;
+	}
+	std::filesystem::path baseDirectory = manifestFilePath.parent_path();
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(manifestFileStream, line)) {
+		++lineNumber;
+		std::istringstream lineStream{line};
+		std::string romStr, inputStr;
+		int frames;
+		if (!(lineStream >> romStr) || (romStr[0] == '#'))
+			continue;
+		if (!(lineStream >> frames) || (frames < 0)) {
+			printf("Manifest line %d: expected a frame count after the ROM\n", lineNumber);
+			return -1;
+		}
+		lineStream >> inputStr;
+
+		BatchJob job{};
+		job.romFilePath = baseDirectory / romStr;
+		job.frames = frames;
+		if (!inputStr.empty())
+			job.inputFilePath = baseDirectory / inputStr;
+		jobs.push_back(job);
+	}
+
+	return 0;
+}
+
+struct InputChange {
+	int frame;
+	u16 keys; // Pressed buttons, 1 = pressed
+};
+
+static int loadInputFile(std::filesystem::path inputFilePath, std::vector<InputChange>& changes) {
+	// One change per line: <frame> <pressed buttons in hex, same bit order as KEYINPUT>
+	std::ifstream inputFileStream{inputFilePath};
+	if (!inputFileStream.is_open()) {
+		printf("Failed to open input file: %s\n", inputFilePath.c_str());
+		return -1;
+	}
+
+	std::string line;
+	while (std::getline(inputFileStream, line)) {
+		std::istringstream lineStream{line};
+		InputChange change;
+		unsigned int keys;
+		if (!(lineStream >> change.frame) || !(lineStream >> std::hex >> keys))
+			continue;
+		change.keys = keys & 0x3FF;
+		changes.push_back(change);
+	}
+
+	std::stable_sort(changes.begin(), changes.end(), [](const InputChange& a, const InputChange& b) { return a.frame < b.frame; });
+	return 0;
+}
+
+static void drainAudio(GameBoyAdvance& gba, u64& audioHash) {
+	audioHash = fnv1a(gba.apu.sampleBuffer.data(), gba.apu.sampleBufferIndex * sizeof(i16), audioHash);
+	gba.apu.sampleBufferIndex = 0;
+}
+
+static void runJob(GameBoyAdvance& gba, BatchJob& job, const BatchOptions& options) {
+	auto startTime = std::chrono::steady_clock::now();
+	job.success = false;
+
+	// Input files are either a movie, replayed to the exact cycle, or a list of per frame changes
+	std::vector<InputChange> inputChanges;
+	bool movieInput = !job.inputFilePath.empty() && GBAMovie::isMovieFile(job.inputFilePath);
+	if (!job.inputFilePath.empty() && !movieInput && loadInputFile(job.inputFilePath, inputChanges))
+		return;
+
+	gba.cpu.hleBios = options.biosFilePath.empty() || gba.loadBios(options.biosFilePath);
+	if (gba.loadRom(job.romFilePath))
+		return;
+	gba.movie.stop();
+	if (movieInput && gba.movie.startPlayback(job.inputFilePath))
+		return;
+	gba.reset();
+	gba.cpu.uncapFps = true;
+	gba.cpu.running = true;
+
+	u64 audioHash = fnv1a(nullptr, 0);
+	gba.apu.onBufferFull = [&]() { drainAudio(gba, audioHash); };
+	size_t nextInput = 0;
+	size_t nextCheckpoint = 0;
+	for (int frame = 0; frame < job.frames; frame++) {
+		while ((nextInput < inputChanges.size()) && (inputChanges[nextInput].frame <= frame))
+			gba.KEYINPUT = ~inputChanges[nextInput++].keys & 0x3FF;
+
+		// Only draw the frames that get hashed. The one before is drawn too, since this loop can notice a new frame a little after its first line.
+		int nextHashedFrame = (nextCheckpoint < job.checkpoints.size()) ? std::min(job.checkpoints[nextCheckpoint].frame, job.frames) : job.frames;
+		gba.ppu.skipDraw = (frame + 2) < nextHashedFrame;
+
+		int frameEnd = gba.ppu.frameCounter + 1;
+		while (gba.ppu.frameCounter < frameEnd)
+			gba.cpu.step();
+
+		while ((nextCheckpoint < job.checkpoints.size()) && (job.checkpoints[nextCheckpoint].frame == (frame + 1))) {
+			drainAudio(gba, audioHash);
+			job.checkpoints[nextCheckpoint].frameHash = fnv1a(gba.ppu.framebuffer, sizeof(gba.ppu.framebuffer));
+			job.checkpoints[nextCheckpoint++].audioHash = audioHash;
+		}
+	}
+	drainAudio(gba, audioHash);
+	gba.apu.onBufferFull = nullptr;
+	gba.ppu.skipDraw = false;
+
+	job.frameHash = fnv1a(gba.ppu.framebuffer, sizeof(gba.ppu.framebuffer));
+	job.audioHash = audioHash;
+	job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	job.success = true;
+}
+
+void runBatch(std::vector<BatchJob>& jobs, const BatchOptions& options) {
+	ThreadPool pool(options.threads);
+
+	// Instances are only created once a worker needs one and are then reused for every job it runs
+	std::vector<std::unique_ptr<GameBoyAdvance>> instances(pool.size());
+	for (auto& job : jobs) {
+		pool.submit([&instances, &job, &options](int workerIndex) {
+			auto& gba = instances[workerIndex];
+			if (!gba) {
+				gba = std::make_unique<GameBoyAdvance>();
+				gba->useSaveFile = false;
+			}
+
+			runJob(*gba, job, options);
+		});
+	}
+	pool.wait();
+}
+
+static std::string jsonEscape(std::string str) {
+	std::string out;
+	for (char c : str) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		default: out += c; break;
+		}
+	}
+
+	return out;
+}
+
+int runBatchManifest(std::filesystem::path manifestFilePath, const BatchOptions& options) {
+	std::vector<BatchJob> jobs;
+	if (loadBatchManifest(manifestFilePath, jobs))
+		return -1;
+
+	auto startTime = std::chrono::steady_clock::now();
+	runBatch(jobs, options);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	// One JSON object per job, in manifest order
+	int failedJobs = 0;
+	for (auto& job : jobs) {
+		if (job.success) {
+			printf("{\"rom\":\"%s\",\"frames\":%d,\"frame_hash\":\"%016llx\",\"audio_hash\":\"%016llx\",\"seconds\":%.6f}\n",
+				jsonEscape(job.romFilePath.string()).c_str(), job.frames, (unsigned long long)job.frameHash, (unsigned long long)job.audioHash, job.seconds);
+		} else {
+			printf("{\"rom\":\"%s\",\"frames\":%d,\"error\":true}\n", jsonEscape(job.romFilePath.string()).c_str(), job.frames);
+			++failedJobs;
+		}
+	}
+	fprintf(stderr, "Ran %d jobs in %.3f seconds (%d failed)\n", (int)jobs.size(), seconds, failedJobs);
+
+	return failedJobs ? -1 : 0;
+}
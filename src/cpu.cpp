@@ -6,6 +6,7 @@
 #include "arm7tdmidisasm.hpp"
 #include "types.hpp"
 #include <cstdio>
+#include <cstring>
 
 GBACPU::GBACPU(GameBoyAdvance& bus_) : ARM7TDMI(bus_), bios(*this) {
 	hleBios = true;
@@ -13,9 +14,17 @@ GBACPU::GBACPU(GameBoyAdvance& bus_) : ARM7TDMI(bus_), bios(*this) {
 	traceInstructions = false;
 	logInterrupts = false;
 	uncapFps = false;
+	runAheadFrames = 0;
+	runningAhead = false;
+	quitting = false;
+	boundaryEventPending = false;
+	disassembler.defaultSettings();
+	skipIdleLoops = true;
+	idleLoopDirty = true;
 
 	currentTime = 0;
-	eventQueue = {};
+	eventsProcessed = 0;
+	clearEvents();
 }
 
 void GBACPU::reset() { // Should only be run once rom is loaded and system is ready
@@ -25,73 +34,239 @@ void GBACPU::reset() { // Should only be run once rom is loaded and system is re
 	halted = false;
 	stopped = false;
 	bios.processJump = false;
+	idleLoopDirty = true;
+	idleLoopBranch = 0;
 
 	resetARM7TDMI();
 }
 
+void GBACPU::serialize(StateSerializer& state) {
+	ARM7TDMI::serialize(state);
+	bios.serialize(state);
+	state(hleBios);
+
+	state(IE);
+	state(IF);
+	state(IME);
+	state(halted);
+	state(stopped);
+
+	// EVENT_STOP belongs to whoever is pausing the emulator, not to the machine, so a pending one carries over
+	bool stopPending = eventTimes[EVENT_STOP] != UINT64_MAX;
+	state(currentTime);
+	state(eventTimes);
+	state(eventImportant);
+	if (state.loading) {
+		eventTimes[EVENT_STOP] = stopPending ? currentTime : UINT64_MAX;
+		findNextEvent();
+		idleLoopDirty = true;
+		idleLoopBranch = 0;
+	}
+}
+
 void GBACPU::run() { // Emulator thread is run from here
-	while (1) {
-		while (!running)
+	while (!quitting) {
+		if (boundaryEventPending) [[unlikely]]
+			processBoundaryEvent();
+
+		if (!running) {
+			processThreadEvents();
+			continue;
+		}
+
+		if (bus.rewind.rewinding) [[unlikely]] {
 			processThreadEvents();
+			bus.rewind.stepBack();
+			continue;
+		}
+
+		step();
+
+		if (bus.ppu.frameCounter != bus.rewind.lastFrame) [[unlikely]] { // Once per frame
+			bus.rewind.captureFrame();
+			runAhead();
+		}
+	}
+}
+
+void GBACPU::step() { // One trip through the emulation loop without touching the thread queue
+	if (!halted) {
+		u64 startEvents = eventsProcessed; // The BIOS jump below can run events too
+		//printf("r0:0x%08X r1:0x%08X r2:0x%08X r3:0x%08X r4:0x%08X r5:0x%08X r6:0x%08X r7:0x%08X r8:0x%08X r9:0x%08X r10:0x%08X r11:0x%08X r12:0x%08X r13:0x%08X r14:0x%08X r15:0x%08X cpsr:0x%08X\n", reg.R[0], reg.R[1], reg.R[2], reg.R[3], reg.R[4], reg.R[5], reg.R[6], reg.R[7], reg.R[8], reg.R[9], reg.R[10], reg.R[11], reg.R[12], reg.R[13], reg.R[14], reg.R[15], readCPSR());
+
+		while (bios.processJump) [[unlikely]]
+			bios.jumpToBios();
 
-		if (!halted) {
-			//printf("r0:0x%08X r1:0x%08X r2:0x%08X r3:0x%08X r4:0x%08X r5:0x%08X r6:0x%08X r7:0x%08X r8:0x%08X r9:0x%08X r10:0x%08X r11:0x%08X r12:0x%08X r13:0x%08X r14:0x%08X r15:0x%08X cpsr:0x%08X\n", reg.R[0], reg.R[1], reg.R[2], reg.R[3], reg.R[4], reg.R[5], reg.R[6], reg.R[7], reg.R[8], reg.R[9], reg.R[10], reg.R[11], reg.R[12], reg.R[13], reg.R[14], reg.R[15], reg.CPSR);
-
-			while (bios.processJump) [[unlikely]]
-				bios.jumpToBios();
-
-			if (traceInstructions) {
-				std::string disasm;
-				std::string logLine;
-				if (reg.thumbMode) {
-					disasm = disassembler.disassemble(reg.R[15] - 4, pipelineOpcode3, true);
-					logLine = fmt::format("0x{:0>7X} |     0x{:0>4X} | {}\n", reg.R[15] - 4, pipelineOpcode3, disasm);
-				} else {
-					disasm = disassembler.disassemble(reg.R[15] - 8, pipelineOpcode3, false);
-					logLine = fmt::format("0x{:0>7X} | 0x{:0>8X} | {}\n", reg.R[15] - 8, pipelineOpcode3, disasm);
-				}
-
-				if (logLine.compare(previousLogLine)) {
-					bus.log << fmt::format("r0:0x{:0>8X} r1:0x{:0>8X} r2:0x{:0>8X} r3:0x{:0>8X} r4:0x{:0>8X} r5:0x{:0>8X} r6:0x{:0>8X} r7:0x{:0>8X} r8:0x{:0>8X} r9:0x{:0>8X} r10:0x{:0>8X} r11:0x{:0>8X} r12:0x{:0>8X} r13:0x{:0>8X} r14:0x{:0>8X} r15:0x{:0>8X} cpsr:0x{:0>8X}\n", reg.R[0], reg.R[1], reg.R[2], reg.R[3], reg.R[4], reg.R[5], reg.R[6], reg.R[7], reg.R[8], reg.R[9], reg.R[10], reg.R[11], reg.R[12], reg.R[13], reg.R[14], reg.R[15], reg.CPSR);
-					bus.log << logLine;
-					previousLogLine = logLine;
-				}
+		if (traceInstructions) {
+			std::string disasm;
+			std::string logLine;
+			if (reg.thumbMode) {
+				disasm = disassembler.disassemble(reg.R[15] - 4, pipelineOpcode3, true);
+				logLine = fmt::format("0x{:0>7X} |     0x{:0>4X} | {}\n", reg.R[15] - 4, pipelineOpcode3, disasm);
+			} else {
+				disasm = disassembler.disassemble(reg.R[15] - 8, pipelineOpcode3, false);
+				logLine = fmt::format("0x{:0>7X} | 0x{:0>8X} | {}\n", reg.R[15] - 8, pipelineOpcode3, disasm);
+			}
+
+			if (logLine.compare(previousLogLine)) {
+				bus.log << fmt::format("r0:0x{:0>8X} r1:0x{:0>8X} r2:0x{:0>8X} r3:0x{:0>8X} r4:0x{:0>8X} r5:0x{:0>8X} r6:0x{:0>8X} r7:0x{:0>8X} r8:0x{:0>8X} r9:0x{:0>8X} r10:0x{:0>8X} r11:0x{:0>8X} r12:0x{:0>8X} r13:0x{:0>8X} r14:0x{:0>8X} r15:0x{:0>8X} cpsr:0x{:0>8X}\n", reg.R[0], reg.R[1], reg.R[2], reg.R[3], reg.R[4], reg.R[5], reg.R[6], reg.R[7], reg.R[8], reg.R[9], reg.R[10], reg.R[11], reg.R[12], reg.R[13], reg.R[14], reg.R[15], readCPSR());
+				bus.log << logLine;
+				previousLogLine = logLine;
 			}
+
 			cycle();
 		} else {
-			// Optimization for halts
-			currentTime = eventQueue.top().timeStamp;
-			tickScheduler(1);
+			// Nothing the caller checks between steps changes until an event runs, so keep going until one does.
+			// Each opcode still goes through cycle(), so this stops on the same cycle as running one opcode per step.
+			do {
+				cycle();
+			} while ((eventsProcessed == startEvents) && !processIrq && !halted && !bios.processJump);
 		}
+	} else {
+		// Optimization for halts
+		currentTime = nextEventTime;
+		tickScheduler(1);
+	}
+}
+
+void GBACPU::runAhead() { // Called at the start of each frame
+	// Games take a frame or more to react to input, so show what the screen will look like a few frames from now.
+	// The real frames are never drawn since only the frames run ahead are shown.
+	bus.ppu.skipDraw = runAheadFrames > 0;
+	if (!runAheadFrames || bus.ppu.skipFrame || (eventTimes[EVENT_STOP] != UINT64_MAX)) // Nothing to show for a skipped frame, and let a pause land on a real frame
+		return;
+
+	int realFrame = bus.ppu.frameCounter;
+	bus.saveState(runAheadState);
+
+	runningAhead = true;
+	bus.apu.discardSamples = true;
+	for (int i = 0; i < runAheadFrames; i++) {
+		bus.ppu.skipDraw = i != (runAheadFrames - 1);
+
+		int frameEnd = bus.ppu.frameCounter + 1;
+		while (bus.ppu.frameCounter < frameEnd)
+			step();
 	}
+	bus.apu.discardSamples = false;
+	bus.ppu.skipDraw = true;
+	runningAhead = false;
+
+	bus.renderThread.finish();
+	memcpy(runAheadFramebuffer, bus.ppu.framebuffer, sizeof(runAheadFramebuffer));
+	memcpy(runAheadLineKeyValid, bus.ppu.lineKeyValid, sizeof(runAheadLineKeyValid));
+	bus.loadState(runAheadState);
+	memcpy(bus.ppu.framebuffer, runAheadFramebuffer, sizeof(runAheadFramebuffer));
+	memcpy(bus.ppu.lineKeyValid, runAheadLineKeyValid, sizeof(runAheadLineKeyValid)); // The framebuffer is back to what the line keys describe
+	bus.ppu.frameCounter = realFrame;
 }
 
 // Scheduler
-bool GBACPU::eventSorter::operator()(const Event &lhs, const Event &rhs) {
-	return lhs.timeStamp > rhs.timeStamp;
+void GBACPU::clearEvents() {
+	for (int i = 0; i < EVENT_COUNT; i++) {
+		eventTimes[i] = UINT64_MAX;
+		eventImportant[i] = false;
+	}
+
+	nextEventTime = UINT64_MAX;
+	nextEvent = EVENT_PPU_LINE_START;
+}
+
+void GBACPU::reschedule(eventType id, u64 timeStamp, bool important) {
+	eventTimes[id] = timeStamp;
+	eventImportant[id] = important;
+
+	if (timeStamp < nextEventTime) {
+		nextEventTime = timeStamp;
+		nextEvent = id;
+	} else if ((id == nextEvent) || (timeStamp == nextEventTime)) {
+		findNextEvent();
+	}
 }
 
-void GBACPU::addEvent(u64 cycles, void (*function)(void*), void *pointer, bool important) {
-	eventQueue.push(Event{currentTime + cycles, function, pointer, important});
+void GBACPU::cancel(eventType id) {
+	eventTimes[id] = UINT64_MAX;
+
+	if (id == nextEvent)
+		findNextEvent();
+}
+
+void GBACPU::findNextEvent() {
+	// Ties go to the lowest slot
+	nextEventTime = eventTimes[0];
+	nextEvent = (eventType)0;
+	for (int i = 1; i < EVENT_COUNT; i++) {
+		if (eventTimes[i] < nextEventTime) {
+			nextEventTime = eventTimes[i];
+			nextEvent = (eventType)i;
+		}
+	}
 }
 
 void GBACPU::tickScheduler(int cycles) {
-	for (int i = 0; i < cycles; i++, currentTime++) {
-		while (currentTime >= eventQueue.top().timeStamp) {
-			auto callback = eventQueue.top().callback;
-			auto userData = eventQueue.top().userData;
-			bool important = eventQueue.top().important;
-
-			eventQueue.pop();
-			(*callback)(userData);
-
-			if (important) { [[unlikely]]
-				do {
-					processThreadEvents();
-				} while (!(running && (!bus.apu.apuBlock || uncapFps) && !stopped));
-			}
+	// Jump straight to each event instead of stepping one cycle at a time
+	while ((cycles > 0) && ((currentTime + cycles) > nextEventTime)) {
+		if (nextEventTime > currentTime) {
+			cycles -= nextEventTime - currentTime;
+			currentTime = nextEventTime;
+		}
+
+		eventType id = nextEvent;
+		bool important = eventImportant[id];
+		eventTimes[id] = UINT64_MAX;
+		findNextEvent();
+		idleLoopDirty = true;
+		++eventsProcessed;
+
+		auto oldSection = bus.profiler.enter(eventSections[id]);
+		switch (id) {
+		case EVENT_PPU_LINE_START: bus.ppu.lineStart(); break;
+		case EVENT_PPU_HBLANK: bus.ppu.hBlank(); break;
+		case EVENT_TIMER0 ... EVENT_TIMER3: bus.timer.checkOverflow(); break;
+		case EVENT_DMA: bus.dma.checkDma(); break;
+		case EVENT_APU_FRAME_SEQUENCER: bus.apu.tickFrameSequencer(); break;
+		case EVENT_APU_SAMPLE: bus.apu.generateSample(); break;
+		case EVENT_MOVIE_INPUT: bus.movie.playInput(); break;
+		case EVENT_STOP: running = false; break;
+		default: break;
+		}
+		bus.profiler.leave(oldSection);
+
+		if (important && !runningAhead) { [[unlikely]] // Anything from the thread queue would be undone along with the frames run ahead
+			do {
+				processThreadEvents();
+			} while (!(running && (!bus.apu.apuBlock || uncapFps) && !stopped) && !quitting && !boundaryEventPending);
 		}
 	}
+
+	currentTime += cycles;
+}
+
+void GBACPU::checkIdleLoop(u32 branchAddress) { // Called after a short backward branch is taken
+	if (!skipIdleLoops)
+		return;
+
+	bool sameState = (branchAddress == idleLoopBranch) && !idleLoopDirty &&
+		!std::memcmp(idleLoopRegs, reg.R, sizeof(idleLoopRegs)) && (idleLoopCPSR == readCPSR()) &&
+		(idleLoopPrefetchRunning == bus.prefetchRunning) && (idleLoopPrefetchIndex == bus.prefetchIndex) && (idleLoopPrefetchCycles == bus.prefetchCycles);
+
+	if (sameState) {
+		// A whole iteration went by without any writes, events, or timer reads and ended in the same state,
+		// so every iteration until the next event will be identical. Skip as many of them as fit.
+		u64 iterationLength = currentTime - idleLoopStartTime;
+		if ((iterationLength > 0) && (nextEventTime > currentTime))
+			currentTime += ((nextEventTime - currentTime) / iterationLength) * iterationLength;
+	} else {
+		idleLoopBranch = branchAddress;
+		std::memcpy(idleLoopRegs, reg.R, sizeof(idleLoopRegs));
+		idleLoopCPSR = readCPSR();
+		idleLoopPrefetchRunning = bus.prefetchRunning;
+		idleLoopPrefetchIndex = bus.prefetchIndex;
+		idleLoopPrefetchCycles = bus.prefetchCycles;
+	}
+
+	idleLoopStartTime = currentTime;
+	idleLoopDirty = false;
 }
 
 // Interrupts
@@ -138,7 +313,7 @@ void GBACPU::requestInterrupt(irqType bit) {
 // Thread queue
 void GBACPU::processThreadEvents() {
 	threadQueueMutex.lock();
-	while (!threadQueue.empty()) {
+	while (!threadQueue.empty() && !boundaryEventPending) { // Anything after a boundary event has to wait for it
 		threadEvent currentEvent = threadQueue.front();
 		threadQueue.pop();
 
@@ -147,7 +322,7 @@ void GBACPU::processThreadEvents() {
 			running = true;
 			break;
 		case STOP:
-			addEvent(currentEvent.intArg, stopEvent, this);
+			reschedule(EVENT_STOP, currentTime + currentEvent.intArg);
 			break;
 		case RESET:
 			bus.reset();
@@ -168,11 +343,31 @@ void GBACPU::processThreadEvents() {
 			}
 			break;
 		case UPDATE_KEYINPUT:
-			bus.KEYINPUT = currentEvent.intArg & 0x3FF;
+			if (bus.movie.mode != GBAMovie::MOVIE_PLAYING) { // The movie has the controller
+				bus.KEYINPUT = currentEvent.intArg & 0x3FF;
+				bus.movie.recordInput();
+			}
 			break;
 		case CLEAR_LOG:
 			bus.log.str("");
 			break;
+		case SAVE_STATE:
+		case LOAD_STATE: // This can be reached in the middle of an instruction, which a savestate can't hold
+		case RECORD_MOVIE:
+		case PLAY_MOVIE: // Nor can a reset, and the movie has to start on the first instruction after it
+			boundaryEvent = currentEvent;
+			boundaryEventPending = true;
+			break;
+		case STOP_MOVIE:
+			if (bus.movie.mode == GBAMovie::MOVIE_RECORDING) {
+				bus.movie.stopRecording(*(std::filesystem::path *)currentEvent.ptrArg);
+			} else {
+				bus.movie.stop();
+			}
+			break;
+		case QUIT:
+			quitting = true;
+			break;
 		default:
 			printf("Unknown thread event:  %d\n", currentEvent.type);
 			break;
@@ -181,6 +376,32 @@ void GBACPU::processThreadEvents() {
 	threadQueueMutex.unlock();
 }
 
+void GBACPU::processBoundaryEvent() { // Called from run() between instructions
+	boundaryEventPending = false;
+
+	switch (boundaryEvent.type) {
+	case SAVE_STATE:
+		bus.saveStateToFile(*(std::filesystem::path *)boundaryEvent.ptrArg);
+		break;
+	case LOAD_STATE:
+		bus.loadStateFromFile(*(std::filesystem::path *)boundaryEvent.ptrArg);
+		break;
+	case RECORD_MOVIE:
+		bus.movie.startRecording();
+		bus.reset();
+		running = true;
+		break;
+	case PLAY_MOVIE:
+		if (!bus.movie.startPlayback(*(std::filesystem::path *)boundaryEvent.ptrArg)) {
+			bus.reset();
+			running = true;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
 void GBACPU::addThreadEvent(threadEventType type) {
 	addThreadEvent(type, 0, nullptr);
 }
@@ -198,7 +419,3 @@ void GBACPU::addThreadEvent(threadEventType type, u64 intArg, void *ptrArg) {
 	threadQueue.push(GBACPU::threadEvent{type, intArg, ptrArg});
 	threadQueueMutex.unlock();
 }
-
-void GBACPU::stopEvent(void *object) {
-	static_cast<GBACPU *>(object)->running = false;
-}
\ No newline at end of file
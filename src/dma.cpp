@@ -24,10 +24,47 @@ void GBADMA::reset() {
 	DMA1SAD = DMA1DAD = DMA1CNT.raw = 0;
 	DMA2SAD = DMA2DAD = DMA2CNT.raw = 0;
 	DMA3SAD = DMA3DAD = DMA3CNT.raw = 0;
+
+	dma0OpenBus = dma1OpenBus = dma2OpenBus = dma3OpenBus = 0;
 }
 
-void GBADMA::dmaCheckEvent(void *object) {
-	static_cast<GBADMA *>(object)->checkDma();
+void GBADMA::serialize(StateSerializer& state) {
+	state(currentDma);
+	state.check((currentDma >= -1) && (currentDma <= 3));
+	state(dma0Queued);
+	state(dma1Queued);
+	state(dma2Queued);
+	state(dma3Queued);
+
+	state(internalDMA0SAD);
+	state(internalDMA0DAD);
+	state(internalDMA0CNT);
+	state(dma0OpenBus);
+	state(internalDMA1SAD);
+	state(internalDMA1DAD);
+	state(internalDMA1CNT);
+	state(dma1OpenBus);
+	state(internalDMA2SAD);
+	state(internalDMA2DAD);
+	state(internalDMA2CNT);
+	state(dma2OpenBus);
+	state(internalDMA3SAD);
+	state(internalDMA3DAD);
+	state(internalDMA3CNT);
+	state(dma3OpenBus);
+
+	state(DMA0SAD);
+	state(DMA0DAD);
+	state(DMA0CNT);
+	state(DMA1SAD);
+	state(DMA1DAD);
+	state(DMA1CNT);
+	state(DMA2SAD);
+	state(DMA2DAD);
+	state(DMA2CNT);
+	state(DMA3SAD);
+	state(DMA3DAD);
+	state(DMA3CNT);
 }
 
 void GBADMA::onVBlank() {
@@ -70,8 +107,15 @@ void GBADMA::onFifoB() {
 	checkDma();
 }
 
+void GBADMA::scheduleCheck() {
+	u64 checkTime = bus.cpu.currentTime + 2; // TODO: Check how long this is and when it happens
+	if (checkTime < bus.cpu.eventTimes[GBACPU::EVENT_DMA])
+		bus.cpu.reschedule(GBACPU::EVENT_DMA, checkTime);
+}
+
 void GBADMA::checkDma() {
 	if (currentDma == -1) {
+		auto oldSection = bus.profiler.enter(GBAProfiler::PROFILE_DMA);
 		if (internalDMA0CNT.enable && dma0Queued) {
 			doDma<0>();
 		} else if (internalDMA1CNT.enable && dma1Queued) {
@@ -81,6 +125,7 @@ void GBADMA::checkDma() {
 		} else if (internalDMA3CNT.enable && dma3Queued) {
 			doDma<3>();
 		}
+		bus.profiler.leave(oldSection);
 	}
 }
 
@@ -374,7 +419,7 @@ void GBADMA::writeIO(u32 address, u8 value) {
 			if (internalDMA0CNT.timing == 0) {
 				dma0Queued = true;
 				//checkDma();
-				bus.cpu.addEvent(2, dmaCheckEvent, this); // TODO: Check how long this is and when it happens
+				scheduleCheck();
 			}
 		}
 		break;
@@ -423,7 +468,7 @@ void GBADMA::writeIO(u32 address, u8 value) {
 			if (internalDMA1CNT.timing == 0) {
 				dma1Queued = true;
 				//checkDma();
-				bus.cpu.addEvent(2, dmaCheckEvent, this);
+				scheduleCheck();
 			}
 		}
 		break;
@@ -472,7 +517,7 @@ void GBADMA::writeIO(u32 address, u8 value) {
 			if (internalDMA2CNT.timing == 0) {
 				dma2Queued = true;
 				//checkDma();
-				bus.cpu.addEvent(2, dmaCheckEvent, this);
+				scheduleCheck();
 			}
 		}
 		break;
@@ -521,7 +566,7 @@ void GBADMA::writeIO(u32 address, u8 value) {
 			if (internalDMA3CNT.timing == 0) {
 				dma3Queued = true;
 				//checkDma();
-				bus.cpu.addEvent(2, dmaCheckEvent, this);
+				scheduleCheck();
 			}
 		}
 		break;
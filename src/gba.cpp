@@ -3,15 +3,18 @@
 #include "arm7tdmi.hpp"
 #include <cstddef>
 #include <cstdio>
+#include <utility>
 
-GameBoyAdvance::GameBoyAdvance() : cpu(*this), apu(*this), dma(*this), ppu(*this), timer(*this) {
+GameBoyAdvance::GameBoyAdvance() : cpu(*this), apu(*this), dma(*this), ppu(*this), timer(*this), rewind(*this), movie(*this), renderThread(*this) {
 	logFlash = false;
+	useSaveFile = true;
 
 	//reset();
 }
 
 GameBoyAdvance::~GameBoyAdvance() {
-	save();
+	if (useSaveFile)
+		save();
 }
 
 void GameBoyAdvance::reset() {
@@ -29,28 +32,24 @@ void GameBoyAdvance::reset() {
 	POSTFLG = false;
 
 	WAITCNT = 0;
-	sramCycles = 5;
-	wsNonSequentialCycles[0] = 5;
-	wsSequentialCycles[0] = 3;
-	wsNonSequentialCycles[1] = 5;
-	wsSequentialCycles[1] = 5;
-	wsNonSequentialCycles[2] = 5;
-	wsSequentialCycles[2] = 9;
 	InternalMemoryControl = 0x0D000000;
-	ewramCycles = 3;
+	updateWaitstates();
 
 	cpu.currentTime = 0;
-	cpu.eventQueue = {};
+	cpu.clearEvents();
 
+	renderThread.finish();
 	apu.reset();
 	dma.reset();
 	ppu.reset();
 	timer.reset();
 	cpu.reset();
+	rewind.reset();
+	movie.reset();
 }
 
 bool GameBoyAdvance::searchRomForString(char *pattern, size_t patternSize) {
-	for (size_t i = 0; i < romBuff.size(); i++) {
+	for (int i = 0; i < romSize; i++) { // Only the real ROM, not the open bus filler after it
 		size_t patternIndex = 0;
 		while (romBuff[i + patternIndex] == pattern[patternIndex]) {
 			if (patternIndex == (patternSize - 1))
@@ -118,41 +117,44 @@ int GameBoyAdvance::loadRom(std::filesystem::path romFilePath_) {
 	saveFilePath = romFilePath_;
 	saveFilePath.replace_extension(".sav");
 
-	std::ifstream saveFileStream{saveFilePath, std::ios::binary};
-	saveFileStream.seekg(0, std::ios::beg);
-
 	// Get save type/size
 	saveType = SRAM_32K;
-	sram.resize(32 * 1024);
+	size_t saveSize = 32 * 1024;
 	char eeprom8KStr[] = "EEPROM_V";
 	if (searchRomForString(eeprom8KStr, sizeof(eeprom8KStr) - 1)) {
 		saveType = EEPROM_8K;
-		sram.resize(8 * 1024);
+		saveSize = 8 * 1024;
 	}
 	char sram32KStr[] = "SRAM_V";
 	if (searchRomForString(sram32KStr, sizeof(sram32KStr) - 1)) {
 		saveType = SRAM_32K;
-		sram.resize(32 * 1024);
+		saveSize = 32 * 1024;
 	}
 	char flash128KStr1[] = "FLASH_V";
 	if (searchRomForString(flash128KStr1, sizeof(flash128KStr1) - 1)) {
 		saveType = FLASH_128K;
-		sram.resize(128 * 1024);
+		saveSize = 128 * 1024;
 	}
 	char flash128KStr2[] = "FLASH512_V";
 	if (searchRomForString(flash128KStr2, sizeof(flash128KStr2) - 1)) {
 		saveType = FLASH_128K;
-		sram.resize(128 * 1024);
+		saveSize = 128 * 1024;
 	}
 	char flash128KStr3[] = "FLASH1M_V";
 	if (searchRomForString(flash128KStr3, sizeof(flash128KStr3) - 1)) {
 		saveType = FLASH_128K;
-		sram.resize(128 * 1024);
+		saveSize = 128 * 1024;
 	}
 
-	saveFileStream.read(reinterpret_cast<char*>(sram.data()), sram.size());
-	saveFileStream.close();
+	sram.assign(saveSize, 0); // Don't leave anything behind from the last ROM
 
+	if (useSaveFile) {
+		std::ifstream saveFileStream{saveFilePath, std::ios::binary};
+		saveFileStream.read(reinterpret_cast<char*>(sram.data()), sram.size());
+		saveFileStream.close();
+	}
+
+	updatePageTable();
 	return 0;
 }
 
@@ -167,6 +169,144 @@ void GameBoyAdvance::save() {
 	saveFileStream.close();
 }
 
+void GameBoyAdvance::serialize(StateSerializer& state) {
+	state(forceNonSequential);
+	state(prefetchRunning);
+	state(prefetchIndex);
+	state.check((prefetchIndex >= 0) && (prefetchIndex <= 8));
+	state(prefetchWaitstate);
+	state.check((prefetchWaitstate >= 0) && (prefetchWaitstate <= 2));
+	state(prefetchCycles);
+	state.check((prefetchCycles >= 0) && (prefetchCycles < 9)); // Always less than the longest sequential waitstate
+	state(prefetchLastAddress);
+
+	auto romSaveType = saveType;
+	size_t romSaveSize = sram.size();
+	state(saveType);
+	state(flashState);
+	state(flashChipId);
+	state(flashBank);
+	state(sram);
+	state.check((saveType == romSaveType) && (sram.size() == romSaveSize) && ((flashBank == 0) || (flashBank == 0x10000))); // Both come from the ROM, which has to match
+
+	state(biosOpenBusValue);
+	state(openBusValue);
+	state(ewram);
+	state(iwram);
+	state(KEYINPUT);
+	state(KEYCNT);
+	state(POSTFLG);
+	state(WAITCNT);
+	state(InternalMemoryControl);
+	if (state.loading)
+		updateWaitstates();
+
+	cpu.serialize(state);
+	apu.serialize(state);
+	dma.serialize(state);
+	ppu.serialize(state);
+	timer.serialize(state);
+	if (state.loading && !state.failed)
+		movie.onStateLoaded();
+}
+
+// Header
+// 0x00: Magic ("GBAS")
+// 0x04: Version
+// 0x08: Size of the whole state in bytes
+// 0x0C: ROM size
+// 0x10: ROM header from 0xA0 to 0xBF, to catch loading a state into the wrong game
+struct StateHeader {
+	u32 magic;
+	u32 version;
+	u32 size;
+	u32 romSize;
+	u8 romHeader[0x20];
+};
+
+void GameBoyAdvance::saveState(std::vector<u8>& buffer) {
+	StateHeader header = {StateSerializer::stateMagic, StateSerializer::stateVersion, 0, (u32)romSize, {}};
+	if (romBuff.size() >= 0xC0)
+		memcpy(header.romHeader, &romBuff[0xA0], sizeof(header.romHeader));
+
+	StateSerializer state(buffer);
+	state(header);
+	serialize(state);
+
+	header.size = state.size();
+	memcpy(buffer.data(), &header, sizeof(header));
+}
+
+int GameBoyAdvance::loadState(const std::vector<u8>& buffer) {
+	StateSerializer state(buffer);
+	StateHeader header;
+	state(header);
+
+	if (state.failed || (header.magic != StateSerializer::stateMagic)) {
+		log << "Not a savestate\n";
+		return -1;
+	}
+	if (header.version != StateSerializer::stateVersion) {
+		log << fmt::format("Savestate is version {}, expected version {}\n", header.version, StateSerializer::stateVersion);
+		return -1;
+	}
+	if (header.size != buffer.size()) {
+		log << "Savestate is truncated\n";
+		return -1;
+	}
+	if ((header.romSize != (u32)romSize) || (romBuff.size() < 0xC0) || memcmp(header.romHeader, &romBuff[0xA0], sizeof(header.romHeader))) {
+		log << "Savestate is for a different ROM\n";
+		return -1;
+	}
+
+	saveState(loadStateBackup); // Corruption isn't found until partway through loading, so keep a way back
+	serialize(state);
+	if (state.failed) {
+		StateSerializer backupState(std::as_const(loadStateBackup));
+		StateHeader backupHeader;
+		backupState(backupHeader);
+		serialize(backupState);
+
+		log << "Savestate is corrupted\n";
+		return -1;
+	}
+	return 0;
+}
+
+int GameBoyAdvance::saveStateToFile(std::filesystem::path stateFilePath) {
+	std::vector<u8> buffer;
+	saveState(buffer);
+
+	std::ofstream stateFileStream{stateFilePath, std::ios::binary | std::ios::trunc};
+	if (!stateFileStream) {
+		printf("Failed to open/create savestate file: %s\n", stateFilePath.c_str());
+		return -1;
+	}
+	stateFileStream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	stateFileStream.close();
+
+	log << "Saved state to " << stateFilePath << "\n";
+	return 0;
+}
+
+int GameBoyAdvance::loadStateFromFile(std::filesystem::path stateFilePath) {
+	std::ifstream stateFileStream{stateFilePath, std::ios::binary};
+	if (!stateFileStream.is_open()) {
+		printf("Failed to open savestate file: %s\n", stateFilePath.c_str());
+		return -1;
+	}
+	std::vector<u8> buffer{std::istreambuf_iterator<char>(stateFileStream), std::istreambuf_iterator<char>()};
+	stateFileStream.close();
+
+	if (loadState(buffer)) {
+		printf("Failed to load savestate file: %s\n", stateFilePath.c_str());
+		return -1;
+	}
+
+	log << "Loaded state from " << stateFilePath << "\n";
+	return 0;
+}
+
 u8 GameBoyAdvance::readDebug(u32 address) {
 	u32 offset;
 
@@ -228,11 +368,120 @@ template u8 GameBoyAdvance::openBus<u8>(u32);
 template u16 GameBoyAdvance::openBus<u16>(u32);
 template u32 GameBoyAdvance::openBus<u32>(u32);
 
+void GameBoyAdvance::updatePageTable() {
+	for (u32 i = 0; i < pageTable.size(); i++) {
+		u32 address = i << pageShift;
+		MemoryPage& page = pageTable[i];
+		page = {};
+
+		switch (address >> 24) {
+		case 0x02: // EWRAM
+			page.read = page.write = &ewram[0] + (address & 0x3FFFF);
+			page.cycles[0][0] = page.cycles[0][1] = ewramCycles;
+			page.cycles[1][0] = page.cycles[1][1] = ewramCycles * 2;
+			page.byteWrites = true;
+			break;
+		case 0x03: // IWRAM
+			page.read = page.write = &iwram[0] + (address & 0x7FFF);
+			page.cycles[0][0] = page.cycles[0][1] = 1;
+			page.cycles[1][0] = page.cycles[1][1] = 1;
+			page.byteWrites = true;
+			break;
+		case 0x06: { // VRAM
+			u32 offset = address & 0x1FFFF;
+			if (offset > 0x17FFF)
+				offset -= 0x8000;
+			page.read = page.write = &ppu.vram[0] + offset;
+			page.cycles[0][0] = page.cycles[0][1] = 1;
+			page.cycles[1][0] = page.cycles[1][1] = 2;
+			page.vram = true;
+			} break;
+		case 0x08 ... 0x0D: { // ROM
+			// The prefetch buffer needs the full read path
+			if (prefetchBufferEnable || (romBuff.size() != 0x2000000))
+				break;
+
+			int waitstate = (address >> 25) & 3;
+			page.read = romBuff.data() + (address & 0x1FFFFFF);
+			page.cycles[0][0] = wsNonSequentialCycles[waitstate];
+			page.cycles[0][1] = wsSequentialCycles[waitstate];
+			page.cycles[1][0] = wsNonSequentialCycles[waitstate] + wsSequentialCycles[waitstate];
+			page.cycles[1][1] = wsSequentialCycles[waitstate] * 2;
+			page.rom = true;
+			} break;
+		}
+	}
+}
+
+template <typename T, bool rotate>
+u32 GameBoyAdvance::finishRead(u32 address, u32 val) {
+	u32 newOpenBus = 0;
+	if constexpr (sizeof(T) == 2) {
+		switch (address >> 24) {
+		case 0x02: // EWRAM
+		case 0x05: // Palette RAM
+		case 0x06: // VRAM
+		case 0x08 ... 0x0D: // Cartridge ROM
+			newOpenBus = (val << 16) | val;
+			break;
+
+		case 0x00 ... 0x01: // BIOS
+			newOpenBus = (val << 16) | (biosOpenBusValue >> 16);
+			break;
+		case 0x07: // OAM
+			newOpenBus = (val << 16) | (openBusValue >> 16);
+			break;
+
+		case 0x03: // IWRAM
+			if (address & 2) {
+				newOpenBus = (val << 16) | (openBusValue & 0x00FF);
+			} else {
+				newOpenBus = (openBusValue & 0xFF00) | val;
+			}
+			break;
+		}
+	} else if constexpr (sizeof(T) == 4) {
+		newOpenBus = val;
+	}
+	if (cpu.reg.R[15] < 0x2000000) {
+		biosOpenBusValue = newOpenBus;
+	} else {
+		openBusValue = newOpenBus;
+	}
+
+	if constexpr (rotate) {
+		// Rotate misaligned loads
+		if ((sizeof(T) == 2) && (address & 1)) [[unlikely]]
+			val = (val >> 8) | (val << 24);
+		if ((sizeof(T) == 4) && (address & 3)) [[unlikely]]
+			val = (val << ((4 - (address & 3)) * 8)) | (val >> ((address & 3) * 8));
+	}
+
+	forceNonSequential = false;
+	return val;
+}
+
 template <typename T, bool code, bool rotate>
 u32 GameBoyAdvance::read(u32 address, bool sequential) {
 	u32 alignedAddress = address & ~(sizeof(T) - 1);
 	u32 offset;
 
+	if ((address >> 28) == 0) [[likely]] {
+		const MemoryPage& page = pageTable[address >> pageShift];
+		if (page.read != nullptr) {
+			if (page.rom) {
+				sequential = sequential && !forceNonSequential && (address & 0x1FFFF);
+				cpu.tickScheduler(page.cycles[sizeof(T) == 4][sequential]);
+			} else {
+				tickPrefetch(page.cycles[sizeof(T) == 4][0]);
+			}
+
+			u32 val = 0;
+			std::memcpy(&val, page.read + (alignedAddress & pageMask), sizeof(T));
+			return finishRead<T, rotate>(address, val);
+		}
+	}
+
 	u32 val = openBus<T>(address);
 	switch (address >> 24) {
 	case 0x00: // BIOS
@@ -391,50 +640,7 @@ u32 GameBoyAdvance::read(u32 address, bool sequential) {
 		break;
 	}
 
-	u32 newOpenBus = 0;
-	if constexpr (sizeof(T) == 2) {
-		switch (address >> 24) {
-		case 0x02: // EWRAM
-		case 0x05: // Palette RAM
-		case 0x06: // VRAM
-		case 0x08 ... 0x0D: // Cartridge ROM
-			newOpenBus = (val << 16) | val;
-			break;
-
-		case 0x00 ... 0x01: // BIOS
-			newOpenBus = (val << 16) | (biosOpenBusValue >> 16);
-			break;
-		case 0x07: // OAM
-			newOpenBus = (val << 16) | (openBusValue >> 16);
-			break;
-
-		case 0x03: // IWRAM
-			if (address & 2) {
-				newOpenBus = (val << 16) | (openBusValue & 0x00FF);
-			} else {
-				newOpenBus = (openBusValue & 0xFF00) | val;
-			}
-			break;
-		}
-	} else if constexpr (sizeof(T) == 4) {
-		newOpenBus = val;
-	}
-	if (cpu.reg.R[15] < 0x2000000) {
-		biosOpenBusValue = newOpenBus;
-	} else {
-		openBusValue = newOpenBus;
-	}
-
-	if constexpr (rotate) {
-		// Rotate misaligned loads
-		if ((sizeof(T) == 2) && (address & 1)) [[unlikely]]
-			val = (val >> 8) | (val << 24);
-		if ((sizeof(T) == 4) && (address & 3)) [[unlikely]]
-			val = (val << ((4 - (address & 3)) * 8)) | (val >> ((address & 3) * 8));
-	}
-
-	forceNonSequential = false;
-	return val;
+	return finishRead<T, rotate>(address, val);
 }
 template u32 GameBoyAdvance::read<u8, false>(u32, bool);
 template u32 GameBoyAdvance::read<u16, true>(u32, bool);
@@ -460,6 +666,7 @@ u8 GameBoyAdvance::readIO(u32 address) {
 			return dma.readIO(address);
 
 		case 0x100 ... 0x10F: // Timer
+			cpu.idleLoopDirty = true; // Counters change without an event
 			return timer.readIO(address);
 
 		case 0x130: // Joypad
@@ -525,15 +732,18 @@ void GameBoyAdvance::writeDebug(u32 address, u8 value, bool unrestricted) {
 		break;
 	case 0x05: // Palette RAM
 		ppu.paletteRam[address & 0x3FF] = value;
+		ppu.markPaletteDirty(address & 0x3FF);
 		break;
 	case 0x06: // VRAM
 		offset = address & 0x1FFFF;
 		if (offset > 0x17FFF)
 			offset -= 0x8000;
 		ppu.vram[offset] = value;
+		ppu.markTileDirty(offset);
 		break;
 	case 0x07: // OAM
 		ppu.oam[address & 0x3FF] = value;
+		ppu.markObjectsDirty(address & 0x3FF);
 		break;
 	case 0x08 ... 0x0D: // ROM
 		offset = address & 0x1000000;
@@ -628,6 +838,19 @@ void GameBoyAdvance::write(u32 address, T value, bool sequential) {
 
 	sequential = sequential && !forceNonSequential && (address & 0x1FFFF);
 	forceNonSequential = false;
+	cpu.idleLoopDirty = true;
+
+	if ((address >> 28) == 0) [[likely]] {
+		const MemoryPage& page = pageTable[address >> pageShift];
+		if ((page.write != nullptr) && ((sizeof(T) != 1) || page.byteWrites)) {
+			tickPrefetch(page.cycles[sizeof(T) == 4][0]);
+
+			std::memcpy(page.write + (alignedAddress & pageMask), &value, sizeof(T));
+			if (page.vram)
+				ppu.markTileDirty(page.write + (alignedAddress & pageMask) - ppu.vram);
+			return;
+		}
+	}
 
 	switch (address >> 24) {
 	case 0x02: // EWRAM
@@ -675,6 +898,7 @@ void GameBoyAdvance::write(u32 address, T value, bool sequential) {
 		} else {
 			std::memcpy(&ppu.paletteRam[0] + (alignedAddress & 0x3FF), &value, sizeof(T));
 		}
+		ppu.markPaletteDirty(alignedAddress & 0x3FF);
 		break;
 	case 0x06: // VRAM
 		if constexpr (sizeof(T) == 4) {
@@ -694,12 +918,14 @@ void GameBoyAdvance::write(u32 address, T value, bool sequential) {
 		} else {
 			std::memcpy(&ppu.vram[0] + offset, &value, sizeof(T));
 		}
+		ppu.markTileDirty(offset);
 		break;
 	case 0x07: // OAM
 		tickPrefetch(1);
 
 		if constexpr (sizeof(T) != 1) {
 			std::memcpy(&ppu.oam[0] + (alignedAddress & 0x3FF), &value, sizeof(T));
+			ppu.markObjectsDirty(alignedAddress & 0x3FF);
 		}
 		break;
 	case 0x08 ... 0x0D: { // ROM
@@ -813,6 +1039,19 @@ template void GameBoyAdvance::write<u32>(u32, u32, bool);
 
 static const int waitCycleTable[4] = {5, 4, 3, 9};
 
+void GameBoyAdvance::updateWaitstates() { // Everything here follows from WAITCNT and the internal memory control register
+	sramCycles = waitCycleTable[sramWaitControl];
+	wsNonSequentialCycles[0] = waitCycleTable[ws0NonSequentialControl];
+	wsSequentialCycles[0] = ws0SequentialControl ? 2 : 3;
+	wsNonSequentialCycles[1] = waitCycleTable[ws1NonSequentialControl];
+	wsSequentialCycles[1] = ws1SequentialControl ? 2 : 5;
+	wsNonSequentialCycles[2] = waitCycleTable[ws2NonSequentialControl];
+	wsSequentialCycles[2] = ws2SequentialControl ? 2 : 9;
+	ewramCycles = (15 - ewramWaitControl) + 1;
+	updatePageTable();
+}
+
+
 void GameBoyAdvance::writeIO(u32 address, u8 value) {
 	if ((address & 0xFFFC) == 0x0800) { [[unlikely]]
 		if ((address & 3) == 0) {
@@ -824,7 +1063,7 @@ void GameBoyAdvance::writeIO(u32 address, u8 value) {
 		} else if ((address & 3) == 3) {
 			InternalMemoryControl = (InternalMemoryControl & 0x00FFFFFF) | ((u32)value << 24);
 
-			ewramCycles = (15 - ewramWaitControl) + 1;
+			updateWaitstates();
 		}
 	}
 
@@ -871,12 +1110,7 @@ void GameBoyAdvance::writeIO(u32 address, u8 value) {
 			break;
 		case 0x204:
 			WAITCNT = (WAITCNT & 0xFF00) | value;
-
-			sramCycles = waitCycleTable[sramWaitControl];
-			wsNonSequentialCycles[0] = waitCycleTable[ws0NonSequentialControl];
-			wsSequentialCycles[0] = ws0SequentialControl ? 2 : 3;
-			wsNonSequentialCycles[1] = waitCycleTable[ws1NonSequentialControl];
-			wsSequentialCycles[1] = ws1SequentialControl ? 2 : 5;
+			updateWaitstates();
 			break;
 		case 0x205:
 			if (prefetchBufferEnable && !(value & 0x40)) {
@@ -886,9 +1120,7 @@ void GameBoyAdvance::writeIO(u32 address, u8 value) {
 			}
 
 			WAITCNT = (WAITCNT & 0x00FF) | ((value & 0x5F) << 8);
-
-			wsNonSequentialCycles[2] = waitCycleTable[ws2NonSequentialControl];
-			wsSequentialCycles[2] = ws2SequentialControl ? 2 : 9;
+			updateWaitstates();
 			break;
 		case 0x208:
 			cpu.IME = (bool)(value & 1);
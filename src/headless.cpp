@@ -0,0 +1,313 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "batch.hpp"
+#include "gba.hpp"
+#include "regression.hpp"
+#include "types.hpp"
+
+// Argument Variables
+bool argRomGiven;
+std::filesystem::path argRomFilePath;
+bool argBiosGiven;
+std::filesystem::path argBiosFilePath;
+int argFrames;
+bool argFramesGiven;
+bool argBenchmark;
+bool argNoSave;
+bool argBatchGiven;
+std::filesystem::path argBatchFilePath;
+int argThreads;
+bool argRegressGiven;
+std::filesystem::path argRegressDirectory;
+bool argUpdateGolden;
+int argCheckpointInterval;
+std::filesystem::path argLoadStateFilePath;
+std::filesystem::path argSaveStateFilePath;
+int argRunAhead;
+int argFrameSkip;
+GBARenderThread::RenderMode argRenderMode;
+bool argMovieGiven;
+std::filesystem::path argMovieFilePath;
+
+void printBenchmark(GameBoyAdvance& gba, double seconds, u64 instructions, u64 events);
+
+constexpr auto cexprHash(const char *str, std::size_t v = 0) noexcept -> std::size_t {
+	return (*str == 0) ? v : 31 * cexprHash(str + 1) + *str;
+}
+
+int main(int argc, char *argv[]) {
+	// Parse arguments
+	argRomGiven = false;
+	argBiosGiven = false;
+	argFrames = 600;
+	argFramesGiven = false;
+	argBenchmark = false;
+	argNoSave = false;
+	argBatchGiven = false;
+	argThreads = 0;
+	argRegressGiven = false;
+	argUpdateGolden = false;
+	argCheckpointInterval = 60;
+	argRunAhead = 0;
+	argFrameSkip = 0;
+	argRenderMode = GBARenderThread::RENDER_SCANLINE;
+	argMovieGiven = false;
+	for (int i = 1; i < argc; i++) {
+		switch (cexprHash(argv[i])) {
+		case cexprHash("--rom"):
+			if (argc == (++i)) {
+				printf("Not enough arguments for flag --rom\n");
+				return -1;
+			}
+			argRomGiven = true;
+			argRomFilePath = argv[i];
+			break;
+		case cexprHash("--bios"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --bios\n");
+				return -1;
+			}
+			argBiosGiven = true;
+			argBiosFilePath = argv[i];
+			break;
+		case cexprHash("--frames"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --frames\n");
+				return -1;
+			}
+			argFramesGiven = true;
+			argFrames = atoi(argv[i]);
+			break;
+		case cexprHash("--benchmark"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --benchmark\n");
+				return -1;
+			}
+			argBenchmark = true;
+			argFramesGiven = true;
+			argFrames = atoi(argv[i]);
+			break;
+		case cexprHash("--batch"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --batch\n");
+				return -1;
+			}
+			argBatchGiven = true;
+			argBatchFilePath = argv[i];
+			break;
+		case cexprHash("--threads"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --threads\n");
+				return -1;
+			}
+			argThreads = atoi(argv[i]);
+			break;
+		case cexprHash("--regress"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --regress\n");
+				return -1;
+			}
+			argRegressGiven = true;
+			argRegressDirectory = argv[i];
+			break;
+		case cexprHash("--checkpoint"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --checkpoint\n");
+				return -1;
+			}
+			argCheckpointInterval = atoi(argv[i]);
+			if (argCheckpointInterval <= 0) {
+				printf("Checkpoint interval must be positive\n");
+				return -1;
+			}
+			break;
+		case cexprHash("--update-golden"):
+			argUpdateGolden = true;
+			break;
+		case cexprHash("--load-state"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --load-state\n");
+				return -1;
+			}
+			argLoadStateFilePath = argv[i];
+			break;
+		case cexprHash("--save-state"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --save-state\n");
+				return -1;
+			}
+			argSaveStateFilePath = argv[i];
+			break;
+		case cexprHash("--movie"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --movie\n");
+				return -1;
+			}
+			argMovieGiven = true;
+			argMovieFilePath = argv[i];
+			break;
+		case cexprHash("--run-ahead"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --run-ahead\n");
+				return -1;
+			}
+			argRunAhead = atoi(argv[i]);
+			break;
+		case cexprHash("--no-save"):
+			argNoSave = true;
+			break;
+		case cexprHash("--frame-skip"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --frame-skip\n");
+				return -1;
+			}
+			argFrameSkip = strcmp(argv[i], "auto") ? atoi(argv[i]) : GBAPPU::frameSkipAuto;
+			break;
+		case cexprHash("--render-thread"):
+			argRenderMode = GBARenderThread::RENDER_THREAD;
+			break;
+		case cexprHash("--render-parallel"):
+			argRenderMode = GBARenderThread::RENDER_PARALLEL;
+			break;
+		default:
+			if (i == 1) {
+				argRomGiven = true;
+				argRomFilePath = argv[i];
+			} else {
+				printf("Unknown argument:  %s\n", argv[i]);
+				return -1;
+			}
+			break;
+		}
+	}
+	if (argBatchGiven) {
+		BatchOptions options;
+		options.threads = argThreads;
+		options.biosFilePath = argBiosGiven ? argBiosFilePath : "";
+		return runBatchManifest(argBatchFilePath, options);
+	}
+	if (argRegressGiven) {
+		if (argUpdateGolden && (argFrames <= 0)) {
+			printf("Frames must be positive to write golden files\n");
+			return -1;
+		}
+
+		BatchOptions options;
+		options.threads = argThreads;
+		options.biosFilePath = argBiosGiven ? argBiosFilePath : "";
+
+		RegressionOptions regressionOptions;
+		regressionOptions.frames = argFrames;
+		regressionOptions.checkpointInterval = argCheckpointInterval;
+		regressionOptions.updateGolden = argUpdateGolden;
+		return runRegression(argRegressDirectory, regressionOptions, options);
+	}
+	if (!argRomGiven) {
+		printf("No ROM given\n");
+		return -1;
+	}
+
+	// Everything runs on the main thread, so there is no emulator thread to create
+	auto gbaPtr = std::make_unique<GameBoyAdvance>();
+	GameBoyAdvance& gba = *gbaPtr;
+	gba.useSaveFile = !argNoSave && !argMovieGiven; // Movies have to start from the same save data on every machine
+
+	// Load everything directly instead of going through the thread queue
+	if (argBiosGiven && gba.loadBios(argBiosFilePath)) {
+		printf("Defaulting to HLE BIOS\n");
+		gba.cpu.hleBios = true;
+	} else {
+		gba.cpu.hleBios = !argBiosGiven;
+	}
+	if (gba.loadRom(argRomFilePath))
+		return -1;
+	if (argMovieGiven && gba.movie.startPlayback(argMovieFilePath))
+		return -1;
+	gba.ppu.frameSkip = argFrameSkip;
+	gba.reset();
+	if (!argLoadStateFilePath.empty() && gba.loadStateFromFile(argLoadStateFilePath))
+		return -1;
+	gba.cpu.uncapFps = true;
+	gba.cpu.runAheadFrames = argRunAhead;
+	gba.renderThread.parallelThreads = argThreads;
+	gba.renderThread.mode = argRenderMode;
+	gba.cpu.running = true;
+
+	u64 startInstructions = gba.cpu.instructionsExecuted;
+	u64 startEvents = gba.cpu.eventsProcessed;
+	if (argBenchmark)
+		gba.profiler.start();
+	auto startTime = std::chrono::steady_clock::now();
+	int startFrame = gba.ppu.frameCounter;
+	int lastFrame = gba.ppu.frameCounter + argFrames;
+	int currentFrame = gba.ppu.frameCounter;
+	gba.ppu.forceDrawFrame = argRunAhead ? lastFrame : (lastFrame - 1); // The one that gets hashed, which with run-ahead is run ahead from the start of the last frame
+	bool untilMovieEnds = argMovieGiven && !argFramesGiven;
+	u64 audioHash = fnv1a(nullptr, 0);
+	gba.apu.onBufferFull = [&]() { // Nothing is playing the samples, so hash them and throw them away
+		audioHash = fnv1a(gba.apu.sampleBuffer.data(), gba.apu.sampleBufferIndex * sizeof(i16), audioHash);
+		gba.apu.sampleBufferIndex = 0;
+	};
+	while (untilMovieEnds ? (gba.movie.mode == GBAMovie::MOVIE_PLAYING) : (gba.ppu.frameCounter < lastFrame)) {
+		gba.cpu.step();
+
+		if (gba.ppu.frameCounter != currentFrame) [[unlikely]] {
+			currentFrame = gba.ppu.frameCounter;
+			if (argRunAhead)
+				gba.cpu.runAhead();
+		}
+	}
+	audioHash = fnv1a(gba.apu.sampleBuffer.data(), gba.apu.sampleBufferIndex * sizeof(i16), audioHash);
+	gba.renderThread.finish();
+	argFrames = gba.ppu.frameCounter - startFrame;
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	gba.profiler.stop();
+
+	if (!argSaveStateFilePath.empty())
+		gba.saveStateToFile(argSaveStateFilePath);
+
+	if (argBenchmark) {
+		printBenchmark(gba, seconds, gba.cpu.instructionsExecuted - startInstructions, gba.cpu.eventsProcessed - startEvents);
+	} else {
+		printf("Ran %d frames in %.3f seconds (%.1f FPS)\n", argFrames, seconds, argFrames / seconds);
+		printf("Frame hash: %016llx  Audio hash: %016llx\n", (unsigned long long)fnv1a(gba.ppu.framebuffer, sizeof(gba.ppu.framebuffer)), (unsigned long long)audioHash);
+	}
+	return 0;
+}
+
+void printBenchmark(GameBoyAdvance& gba, double seconds, u64 instructions, u64 events) {
+	constexpr double gbaFps = 16777216.0 / 280896.0;
+	double fps = argFrames / seconds;
+	double ips = instructions / seconds;
+	double eventsPerSecond = events / seconds;
+	u64 lines = gba.ppu.linesDrawn + gba.ppu.linesReused;
+	double lineReuse = lines ? ((double)gba.ppu.linesReused / lines) : 0;
+
+	const char *sectionNames[GBAProfiler::PROFILE_COUNT] = {"cpu", "ppu", "apu", "dma"};
+	u64 totalTime = 0;
+	for (int i = 0; i < GBAProfiler::PROFILE_COUNT; i++)
+		totalTime += gba.profiler.sectionTime[i];
+	if (totalTime == 0)
+		totalTime = 1;
+
+	// Plain text
+	printf("Frames:            %d in %.3f seconds\n", argFrames, seconds);
+	printf("Speed:             %.1f FPS (%.2fx real time)\n", fps, fps / gbaFps);
+	printf("Instructions:      %llu (%.2f MIPS)\n", (unsigned long long)instructions, ips / 1000000);
+	printf("Scheduler events:  %llu (%.0f per second)\n", (unsigned long long)events, eventsPerSecond);
+	printf("Lines reused:      %llu of %llu (%.1f%%)\n", (unsigned long long)gba.ppu.linesReused, (unsigned long long)lines, lineReuse * 100);
+	for (int i = 0; i < GBAProfiler::PROFILE_COUNT; i++) {
+		printf("  %s time:         %8.1f ms (%5.1f%%)\n", sectionNames[i], gba.profiler.sectionTime[i] / 1000000.0, (gba.profiler.sectionTime[i] * 100.0) / totalTime);
+	}
+
+	// JSON on one line so scripts can grab the last line of output
+	printf("{\"frames\":%d,\"seconds\":%.6f,\"fps\":%.3f,\"instructions\":%llu,\"ips\":%.0f,\"events\":%llu,\"events_per_second\":%.0f,\"line_reuse\":%.4f,\"time_ms\":{",
+		argFrames, seconds, fps, (unsigned long long)instructions, ips, (unsigned long long)events, eventsPerSecond, lineReuse);
+	for (int i = 0; i < GBAProfiler::PROFILE_COUNT; i++)
+		printf("%s\"%s\":%.3f", i ? "," : "", sectionNames[i], gba.profiler.sectionTime[i] / 1000000.0);
+	printf("}}\n");
+}
@@ -12,6 +12,13 @@ GBABIOS::GBABIOS(GBACPU& cpu_) : cpu(cpu_) {
 	//
 }
 
+void GBABIOS::serialize(StateSerializer& state) {
+	state(processJump);
+	state(out0);
+	state(out1);
+	state(out3);
+}
+
 void GBABIOS::jumpToBios() {
 	processJump = false;
 	switch (cpu.reg.R[15] - (cpu.reg.thumbMode ? 4 : 8)) {
@@ -70,6 +77,7 @@ void GBABIOS::enterSwi() {
 	cpu.reg.R[13] -= 4;
 	// and r11, r11, #0x80; orr r11, r11, #0x1f; msr cpsr_fc, r11
 	cpu.bankRegisters(GBACPU::MODE_SYSTEM, false); // Functions are run in system mode
+	cpu.materializeFlags();
 	cpu.reg.CPSR = (oldSpsr & 0x80) | 0x1F;
 	// stmdb r13!, {r2, lr}
 	cpu.bus.write(cpu.reg.R[13] - 8, cpu.reg.R[2], false);
@@ -130,6 +138,7 @@ void GBABIOS::exitSwi() {
 	cpu.reg.R[13] += 8;
 	// mov r12, #0xd3; msr cpsr_fc, r12
 	cpu.bankRegisters(GBACPU::MODE_SUPERVISOR, false);
+	cpu.materializeFlags();
 	cpu.reg.CPSR = 0xD3;
 	// ldm sp!, {r11}; msr spsr_fc, r11
 	cpu.reg.SPSR_svc = cpu.bus.read<u32, false, false>(cpu.reg.R[13], false);
@@ -184,6 +193,7 @@ void GBABIOS::SoftReset() { // 0x00
 	for (int i = 0; i <= 13; i++)
 		cpu.reg.R[i] = 0;
 	cpu.reg.R[14] = multiboot ? 0x2000000 : 0x8000000;
+	cpu.materializeFlags();
 	cpu.reg.CPSR = 0x1F;
 	// bx lr
 	cpu.tickScheduler(1);
@@ -266,7 +276,7 @@ void GBABIOS::Halt() { // 0x02
 
 	cpu.bus.write<u8>(0x4000301, 0, false); // HALTCNT
 	while (!cpu.halted) {
-		cpu.currentTime = cpu.eventQueue.top().timeStamp;
+		cpu.currentTime = cpu.nextEventTime;
 		cpu.tickScheduler(1);
 	}
 }
@@ -277,8 +287,8 @@ void GBABIOS::Stop() { // 0x03
 	cpu.tickScheduler(3);
 
 	cpu.bus.write<u8>(0x4000301, 0x80, false); // HALTCNT
-	while (!cpu.stopped) {
-		cpu.currentTime = cpu.eventQueue.top().timeStamp;
+	while (!cpu.stopped && !cpu.quitting) {
+		cpu.currentTime = cpu.nextEventTime;
 		cpu.tickScheduler(1);
 	}
 }
@@ -306,7 +316,7 @@ void GBABIOS::IntrWait(bool discardOldFlags, u16 wantedFlags) { // 0x04
 
 	cpu.bus.write<u8>(0x4000301, 0, false); // strb r3, [r12, #0x301]
 	while (!cpu.processIrq) {
-		cpu.currentTime = cpu.eventQueue.top().timeStamp;
+		cpu.currentTime = cpu.nextEventTime;
 		cpu.tickScheduler(1);
 	}
 	cpu.reg.R[15] = 0x0348 + 8;
@@ -326,7 +336,7 @@ void GBABIOS::loopIntrWait() {
 		
 		cpu.bus.write<u8>(0x4000301, 0, false); // strb r3, [r12, #0x301]
 		while (!cpu.processIrq) {
-			cpu.currentTime = cpu.eventQueue.top().timeStamp;
+			cpu.currentTime = cpu.nextEventTime;
 			cpu.tickScheduler(1);
 		}
 		cpu.reg.R[15] = 0x0348 + 8;
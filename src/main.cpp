@@ -1,6 +1,7 @@
 
 #include <cstdio>
 #include <list>
+#include <memory>
 
 #include "SDL_audio.h"
 #include "SDL_timer.h"
@@ -25,36 +26,37 @@ bool recordSound;
 bool argWavGiven;
 std::filesystem::path argWavFilePath;
 bool argUncapFps;
+int argRunAhead;
+int argFrameSkip;
+GBARenderThread::RenderMode argRenderMode;
+std::filesystem::path stateFilePath;
+std::filesystem::path movieFilePath;
 
 constexpr auto cexprHash(const char *str, std::size_t v = 0) noexcept -> std::size_t {
 	return (*str == 0) ? v : 31 * cexprHash(str + 1) + *str;
 }
 
-// Create emulator thread
-GameBoyAdvance GBA;
-std::thread emuThread(&GBACPU::run, std::ref(GBA.cpu));
-
 // Graphics
 SDL_Window* window;
 GLuint lcdTexture;
 
 // ImGui Windows
-void mainMenuBar();
+void mainMenuBar(GameBoyAdvance& gba);
 bool showDemoWindow;
 bool showRomInfo;
-void romInfoWindow();
+void romInfoWindow(GameBoyAdvance& gba);
 bool showNoBios;
-void noBiosWindow();
+void noBiosWindow(GameBoyAdvance& gba);
 bool showCpuDebug;
-void cpuDebugWindow();
+void cpuDebugWindow(GameBoyAdvance& gba);
 bool showSystemLog;
-void systemLogWindow();
+void systemLogWindow(GameBoyAdvance& gba);
 bool showMemEditor;
-void memEditorWindow();
+void memEditorWindow(GameBoyAdvance& gba);
 #include "ppudebug.hpp"
 
-void romFileDialog();
-void biosFileDialog();
+void romFileDialog(GameBoyAdvance& gba);
+void biosFileDialog(GameBoyAdvance& gba);
 bool memEditorUnrestrictedWrites = false;
 MemoryEditor memEditor;
 ImU8 memEditorRead(const ImU8* data, size_t off);
@@ -85,9 +87,13 @@ void audioCallback(void *userdata, uint8_t *stream, int len);
 
 // Everything else
 std::atomic<bool> quit = false;
-void loadRom();
+void loadRom(GameBoyAdvance& gba);
 
 int main(int argc, char *argv[]) {
+	auto gbaPtr = std::make_unique<GameBoyAdvance>();
+	GameBoyAdvance& gba = *gbaPtr;
+	std::thread emuThread(&GBACPU::run, std::ref(gba.cpu));
+
 	// Parse arguments
 	argRomGiven = false;
 	argBiosGiven = false;
@@ -95,6 +101,9 @@ int main(int argc, char *argv[]) {
 	recordSound = false;
 	argWavGiven = false;
 	argUncapFps = false;
+	argRunAhead = 0;
+	argFrameSkip = 0;
+	argRenderMode = GBARenderThread::RENDER_SCANLINE;
 	for (int i = 1; i < argc; i++) {
 		switch (cexprHash(argv[i])) {
 		case cexprHash("--rom"):
@@ -125,6 +134,26 @@ int main(int argc, char *argv[]) {
 		case cexprHash("--uncap-fps"):
 			argUncapFps = true;
 			break;
+		case cexprHash("--run-ahead"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --run-ahead\n");
+				return -1;
+			}
+			argRunAhead = atoi(argv[i]);
+			break;
+		case cexprHash("--frame-skip"):
+			if (argc == ++i) {
+				printf("Not enough arguments for flag --frame-skip\n");
+				return -1;
+			}
+			argFrameSkip = strcmp(argv[i], "auto") ? atoi(argv[i]) : GBAPPU::frameSkipAuto;
+			break;
+		case cexprHash("--render-thread"):
+			argRenderMode = GBARenderThread::RENDER_THREAD;
+			break;
+		case cexprHash("--render-parallel"):
+			argRenderMode = GBARenderThread::RENDER_PARALLEL;
+			break;
 		default:
 			if (i == 1) {
 				argRomGiven = true;
@@ -137,8 +166,7 @@ int main(int argc, char *argv[]) {
 		}
 	}
 	if (argRomGiven)
-		loadRom();
-	disassembler.defaultSettings();
+		loadRom(gba);
 
 	// Setup SDL and OpenGL
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) {
@@ -168,7 +196,7 @@ int main(int argc, char *argv[]) {
 		.channels = 2,
 		.samples = 1024,
 		.callback = audioCallback,
-		.userdata = nullptr
+		.userdata = &gba
 	};
 	audioDevice = SDL_OpenAudioDevice(nullptr, 0, &desiredAudioSpec, &audioSpec, 0);
 	SDL_PauseAudioDevice(audioDevice, 0);
@@ -200,6 +228,7 @@ int main(int argc, char *argv[]) {
 	NFD::Guard nfdGuard;
 
 	int renderThreadFps = 0;
+	int lineReusePercent = 0;
 	int emuThreadFps = 0;
 	u32 lastFpsPoll = 0;
 	SDL_Event event;
@@ -217,16 +246,27 @@ int main(int argc, char *argv[]) {
 				if (event.key.keysym.mod & KMOD_CTRL) {
 					switch (event.key.keysym.sym) {
 					case SDLK_s:
-						GBA.save();
+						gba.save();
 						break;
 					case SDLK_o:
 						if (event.key.keysym.mod & KMOD_SHIFT) {
-							biosFileDialog();
+							biosFileDialog(gba);
 						} else {
-							romFileDialog();
+							romFileDialog(gba);
 						}
 						break;
 					}
+				} else {
+					switch (event.key.keysym.sym) {
+					case SDLK_F5:
+						if (argRomGiven)
+							gba.cpu.addThreadEvent(GBACPU::SAVE_STATE, &stateFilePath);
+						break;
+					case SDLK_F7:
+						if (argRomGiven)
+							gba.cpu.addThreadEvent(GBACPU::LOAD_STATE, &stateFilePath);
+						break;
+					}
 				}
 				break;
 			}
@@ -239,14 +279,15 @@ int main(int argc, char *argv[]) {
 				currentJoypad |= 1 << i;
 		}
 		if (currentJoypad != lastJoypad) {
-			GBA.cpu.addThreadEvent(GBACPU::UPDATE_KEYINPUT, ~currentJoypad);
+			gba.cpu.addThreadEvent(GBACPU::UPDATE_KEYINPUT, ~currentJoypad);
 			lastJoypad = currentJoypad;
 		}
+		gba.rewind.rewinding = gba.rewind.enabled && currentKeyStates[SDL_SCANCODE_R];
 
-		if (GBA.ppu.updateScreen) {
+		if (gba.ppu.updateScreen) {
 			glBindTexture(GL_TEXTURE_2D, lcdTexture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, 240, 160, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, GBA.ppu.framebuffer);
-			GBA.ppu.updateScreen = false;
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, 240, 160, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, gba.ppu.framebuffer);
+			gba.ppu.updateScreen = false;
 		}
 
 		/* Draw ImGui Stuff */
@@ -254,32 +295,35 @@ int main(int argc, char *argv[]) {
 		ImGui_ImplSDL2_NewFrame();
 		ImGui::NewFrame();
 
-		mainMenuBar();
+		mainMenuBar(gba);
 
 		if (showDemoWindow)
 			ImGui::ShowDemoWindow(&showDemoWindow);
 		if (showRomInfo)
-			romInfoWindow();
+			romInfoWindow(gba);
 		if (showNoBios)
-			noBiosWindow();
+			noBiosWindow(gba);
 		if (showCpuDebug)
-			cpuDebugWindow();
+			cpuDebugWindow(gba);
 		if (showSystemLog)
-			systemLogWindow();
+			systemLogWindow(gba);
 		if (showMemEditor)
-			memEditorWindow();
+			memEditorWindow(gba);
 		if (showLayerView)
-			layerViewWindow();
+			layerViewWindow(gba);
 		if (showTiles)
-			tilesWindow();
+			tilesWindow(gba);
 		if (showPalette)
-			paletteWindow();
+			paletteWindow(gba);
 
 		if ((SDL_GetTicks() - lastFpsPoll) >= 1000) {
 			lastFpsPoll = SDL_GetTicks();
 			renderThreadFps = (int)io.Framerate;
-			emuThreadFps = GBA.ppu.frameCounter;
-			GBA.ppu.frameCounter = 0;
+			emuThreadFps = gba.ppu.frameCounter;
+			gba.ppu.frameCounter = 0;
+			u64 lines = gba.ppu.linesDrawn + gba.ppu.linesReused;
+			lineReusePercent = lines ? (int)((gba.ppu.linesReused * 100) / lines) : 0;
+			gba.ppu.linesDrawn = gba.ppu.linesReused = 0;
 		}
 
 		// Console Screen
@@ -288,6 +332,7 @@ int main(int argc, char *argv[]) {
 
 			ImGui::Text("Rendering Thread:  %d FPS", renderThreadFps);
 			ImGui::Text("Emulator Thread:   %d FPS", emuThreadFps);
+			ImGui::Text("Lines Reused:      %d%%", lineReusePercent);
 			ImGui::Image((void*)(intptr_t)lcdTexture, ImVec2(240 * 3, 160 * 3));
 
 			ImGui::End();
@@ -302,8 +347,8 @@ int main(int argc, char *argv[]) {
 		SDL_GL_SwapWindow(window);
 	}
 
-	GBA.cpu.addThreadEvent(GBACPU::STOP, (u64)0);
-	emuThread.detach();
+	gba.cpu.addThreadEvent(GBACPU::QUIT);
+	emuThread.join(); // gba goes away when main() returns
 
 	// WAV file
 	if (argWavGiven) {
@@ -345,48 +390,79 @@ int main(int argc, char *argv[]) {
 }
 
 void audioCallback(void *userdata, uint8_t *stream, int len) {
-	GBA.apu.sampleBufferMutex.lock();
+	GameBoyAdvance& gba = *(GameBoyAdvance *)userdata;
+	gba.apu.sampleBufferMutex.lock();
 	if (recordSound) {
-		wavFileData.insert(wavFileData.end(), GBA.apu.sampleBuffer.begin(), GBA.apu.sampleBuffer.begin() + GBA.apu.sampleBufferIndex);
+		wavFileData.insert(wavFileData.end(), gba.apu.sampleBuffer.begin(), gba.apu.sampleBuffer.begin() + gba.apu.sampleBufferIndex);
 	}
 
-	memcpy(stream, &GBA.apu.sampleBuffer, len); // Copy samples to SDL's buffer
+	memcpy(stream, &gba.apu.sampleBuffer, len); // Copy samples to SDL's buffer
 	// If there aren't enough samples, repeat the last one
-	int realIndex = (GBA.apu.sampleBufferIndex - 2) % 2048;
-	for (int i = GBA.apu.sampleBufferIndex; i < len / 2; i += 2) {
-		((u16 *)stream)[i] = GBA.apu.sampleBuffer[realIndex];
-		((u16 *)stream)[i + 1] = GBA.apu.sampleBuffer[realIndex + 1];
+	int realIndex = (gba.apu.sampleBufferIndex - 2) % 2048;
+	for (int i = gba.apu.sampleBufferIndex; i < len / 2; i += 2) {
+		((u16 *)stream)[i] = gba.apu.sampleBuffer[realIndex];
+		((u16 *)stream)[i + 1] = gba.apu.sampleBuffer[realIndex + 1];
 	}
 
-	GBA.apu.sampleBufferIndex = 0;
-	GBA.apu.apuBlock = false;
-	GBA.apu.sampleBufferMutex.unlock();
+	gba.apu.sampleBufferIndex = 0;
+	gba.apu.apuBlock = false;
+	gba.apu.sampleBufferMutex.unlock();
 }
 
-void loadRom() {
-	GBA.cpu.addThreadEvent(GBACPU::STOP);
-	GBA.cpu.addThreadEvent(GBACPU::LOAD_BIOS, &argBiosFilePath);
-	GBA.cpu.addThreadEvent(GBACPU::LOAD_ROM, &argRomFilePath);
-	GBA.cpu.addThreadEvent(GBACPU::RESET);
-	GBA.cpu.addThreadEvent(GBACPU::START);
-
-	GBA.cpu.uncapFps = argUncapFps;
+void loadRom(GameBoyAdvance& gba) {
+	gba.cpu.addThreadEvent(GBACPU::STOP);
+	gba.cpu.addThreadEvent(GBACPU::LOAD_BIOS, &argBiosFilePath);
+	gba.cpu.addThreadEvent(GBACPU::LOAD_ROM, &argRomFilePath);
+	stateFilePath = argRomFilePath;
+	stateFilePath.replace_extension(".state");
+	movieFilePath = argRomFilePath;
+	movieFilePath.replace_extension(".movie");
+	gba.cpu.addThreadEvent(GBACPU::RESET);
+	gba.cpu.addThreadEvent(GBACPU::START);
+
+	gba.cpu.uncapFps = argUncapFps;
+	gba.cpu.runAheadFrames = argRunAhead;
+	gba.ppu.frameSkip = argFrameSkip;
+	gba.renderThread.mode = argRenderMode;
 }
 
-void mainMenuBar() {
+void mainMenuBar(GameBoyAdvance& gba) {
 	ImGui::BeginMainMenuBar();
 
 	if (ImGui::BeginMenu("File")) {
 		if (ImGui::MenuItem("Load ROM", "Ctrl+O")) {
-			romFileDialog();
+			romFileDialog(gba);
 		}
 
 		if (ImGui::MenuItem("Load Bios", "Ctrl+Shift+O")) {
-			biosFileDialog();
+			biosFileDialog(gba);
 		}
 
 		if (ImGui::MenuItem("Save", "Ctrl+S", false, argRomGiven)) {
-			GBA.save();
+			gba.save();
+		}
+
+		if (ImGui::MenuItem("Save State", "F5", false, argRomGiven)) {
+			gba.cpu.addThreadEvent(GBACPU::SAVE_STATE, &stateFilePath);
+		}
+
+		if (ImGui::MenuItem("Load State", "F7", false, argRomGiven)) {
+			gba.cpu.addThreadEvent(GBACPU::LOAD_STATE, &stateFilePath);
+		}
+
+		ImGui::Separator();
+		if (gba.movie.mode == GBAMovie::MOVIE_OFF) {
+			if (ImGui::MenuItem("Record Movie", nullptr, false, argRomGiven)) {
+				gba.cpu.addThreadEvent(GBACPU::RECORD_MOVIE);
+			}
+
+			if (ImGui::MenuItem("Play Movie", nullptr, false, argRomGiven)) {
+				gba.cpu.addThreadEvent(GBACPU::PLAY_MOVIE, &movieFilePath);
+			}
+		} else {
+			if (ImGui::MenuItem((gba.movie.mode == GBAMovie::MOVIE_RECORDING) ? "Stop Recording" : "Stop Playback")) {
+				gba.cpu.addThreadEvent(GBACPU::STOP_MOVIE, &movieFilePath);
+			}
 		}
 
 		ImGui::Separator();
@@ -396,26 +472,60 @@ void mainMenuBar() {
 	}
 
 	if (ImGui::BeginMenu("Emulation")) {
-		if (GBA.cpu.running) {
+		if (gba.cpu.running) {
 			if (ImGui::MenuItem("Pause"))
-				GBA.cpu.addThreadEvent(GBACPU::STOP, (u64)0);
+				gba.cpu.addThreadEvent(GBACPU::STOP, (u64)0);
 		} else {
 			if (ImGui::MenuItem("Unpause"))
-				GBA.cpu.addThreadEvent(GBACPU::START);
+				gba.cpu.addThreadEvent(GBACPU::START);
 		}
 		if (ImGui::MenuItem("Reset")) {
-			GBA.cpu.addThreadEvent(GBACPU::RESET);
-			GBA.cpu.addThreadEvent(GBACPU::START);
+			gba.cpu.addThreadEvent(GBACPU::RESET);
+			gba.cpu.addThreadEvent(GBACPU::START);
+		}
+
+		ImGui::Separator();
+		ImGui::MenuItem("Rewind", "Hold R", &gba.rewind.enabled);
+		if (gba.rewind.enabled)
+			ImGui::TextDisabled("%.1f seconds saved (%.1f MB)", gba.rewind.historyFrames() / 59.73, gba.rewind.historyBytes() / (1024.0 * 1024.0));
+		if (ImGui::BeginMenu("Run Ahead")) {
+			const char *runAheadNames[] = {"Off", "1 Frame", "2 Frames", "3 Frames", "4 Frames"};
+			for (int i = 0; i < 5; i++) {
+				if (ImGui::MenuItem(runAheadNames[i], nullptr, gba.cpu.runAheadFrames == i))
+					argRunAhead = gba.cpu.runAheadFrames = i;
+			}
+
+			ImGui::EndMenu();
+		}
+		if (ImGui::BeginMenu("Frame Skip")) {
+			const char *frameSkipNames[] = {"Off", "1 Frame", "2 Frames", "3 Frames"};
+			for (int i = 0; i < 4; i++) {
+				if (ImGui::MenuItem(frameSkipNames[i], nullptr, gba.ppu.frameSkip == i))
+					argFrameSkip = gba.ppu.frameSkip = i;
+			}
+			if (ImGui::MenuItem("Auto", nullptr, gba.ppu.frameSkip == GBAPPU::frameSkipAuto))
+				argFrameSkip = gba.ppu.frameSkip = GBAPPU::frameSkipAuto;
+
+			ImGui::EndMenu();
+		}
+		if (ImGui::BeginMenu("Renderer")) {
+			const char *renderModeNames[] = {"Scanline", "Render Thread", "Parallel"};
+			for (int i = 0; i < 3; i++) {
+				if (ImGui::MenuItem(renderModeNames[i], nullptr, argRenderMode == i))
+					gba.renderThread.mode = argRenderMode = (GBARenderThread::RenderMode)i;
+			}
+
+			ImGui::EndMenu();
 		}
 
 		ImGui::Separator();
 		if (ImGui::BeginMenu("Audio Channels")) {
-			ImGui::MenuItem("Channel 1", nullptr, &GBA.apu.ch1OverrideEnable);
-			ImGui::MenuItem("Channel 2", nullptr, &GBA.apu.ch2OverrideEnable);
-			ImGui::MenuItem("Channel 3", nullptr, &GBA.apu.ch3OverrideEnable);
-			ImGui::MenuItem("Channel 4", nullptr, &GBA.apu.ch4OverrideEnable);
-			ImGui::MenuItem("Channel A", nullptr, &GBA.apu.chAOverrideEnable);
-			ImGui::MenuItem("Channel B", nullptr, &GBA.apu.chBOverrideEnable);
+			ImGui::MenuItem("Channel 1", nullptr, &gba.apu.ch1OverrideEnable);
+			ImGui::MenuItem("Channel 2", nullptr, &gba.apu.ch2OverrideEnable);
+			ImGui::MenuItem("Channel 3", nullptr, &gba.apu.ch3OverrideEnable);
+			ImGui::MenuItem("Channel 4", nullptr, &gba.apu.ch4OverrideEnable);
+			ImGui::MenuItem("Channel A", nullptr, &gba.apu.chAOverrideEnable);
+			ImGui::MenuItem("Channel B", nullptr, &gba.apu.chBOverrideEnable);
 
 			ImGui::EndMenu();
 		}
@@ -439,11 +549,11 @@ void mainMenuBar() {
 	ImGui::EndMainMenuBar();
 }
 
-void romInfoWindow() {
+void romInfoWindow(GameBoyAdvance& gba) {
 	ImGui::Begin("ROM Info", &showRomInfo);
 
 	std::string saveTypeString;
-	switch (GBA.saveType) {
+	switch (gba.saveType) {
 	case GameBoyAdvance::UNKNOWN:
 		saveTypeString = "Unknown";
 		break;
@@ -468,7 +578,7 @@ void romInfoWindow() {
 	ImGui::End();
 }
 
-void noBiosWindow() {
+void noBiosWindow(GameBoyAdvance& gba) {
 	// Center window
 	ImGui::SetNextWindowPos(ImVec2(ImGui::GetIO().DisplaySize.x * 0.5f, ImGui::GetIO().DisplaySize.y * 0.5f), ImGuiCond_Always, ImVec2(0.5, 0.5));
 	ImGui::Begin("No BIOS Selected");
@@ -481,64 +591,64 @@ void noBiosWindow() {
 	ImGui::SameLine();
 	if (ImGui::Button("Continue")) {
 		showNoBios = false;
-		loadRom();
+		loadRom(gba);
 	}
 
 	ImGui::End();
 }
 
-void cpuDebugWindow() {
+void cpuDebugWindow(GameBoyAdvance& gba) {
 	ImGui::Begin("Debug CPU", &showCpuDebug);
 
 	if (ImGui::Button("Reset"))
-		GBA.cpu.addThreadEvent(GBACPU::RESET);
+		gba.cpu.addThreadEvent(GBACPU::RESET);
 	ImGui::SameLine();
-	if (GBA.cpu.running) {
+	if (gba.cpu.running) {
 		if (ImGui::Button("Pause"))
-			GBA.cpu.addThreadEvent(GBACPU::STOP, (u64)0);
+			gba.cpu.addThreadEvent(GBACPU::STOP, (u64)0);
 	} else {
 		if (ImGui::Button("Unpause"))
-			GBA.cpu.addThreadEvent(GBACPU::START);
+			gba.cpu.addThreadEvent(GBACPU::START);
 	}
 
 	ImGui::Spacing();
 	if (ImGui::Button("Step")) {
 		// Add events the hard way so mutex doesn't have to be unlocked
-		GBA.cpu.threadQueueMutex.lock();
-		GBA.cpu.threadQueue.push(GBACPU::threadEvent{GBACPU::START, 0, nullptr});
-		GBA.cpu.threadQueue.push(GBACPU::threadEvent{GBACPU::STOP, 1, nullptr});
-		GBA.cpu.threadQueueMutex.unlock();
+		gba.cpu.threadQueueMutex.lock();
+		gba.cpu.threadQueue.push(GBACPU::threadEvent{GBACPU::START, 0, nullptr});
+		gba.cpu.threadQueue.push(GBACPU::threadEvent{GBACPU::STOP, 1, nullptr});
+		gba.cpu.threadQueueMutex.unlock();
 	}
 
 	ImGui::Separator();
-	std::string tmp = disassembler.disassemble(GBA.cpu.reg.R[15] - (GBA.cpu.reg.thumbMode ? 4 : 8), GBA.cpu.pipelineOpcode3, GBA.cpu.reg.thumbMode);
+	std::string tmp = gba.cpu.disassembler.disassemble(gba.cpu.reg.R[15] - (gba.cpu.reg.thumbMode ? 4 : 8), gba.cpu.pipelineOpcode3, gba.cpu.reg.thumbMode);
 	ImGui::Text("Current Opcode:  %s", tmp.c_str());
 	ImGui::Spacing();
-	ImGui::Text("r0:  %08X", GBA.cpu.reg.R[0]);
-	ImGui::Text("r1:  %08X", GBA.cpu.reg.R[1]);
-	ImGui::Text("r2:  %08X", GBA.cpu.reg.R[2]);
-	ImGui::Text("r3:  %08X", GBA.cpu.reg.R[3]);
-	ImGui::Text("r4:  %08X", GBA.cpu.reg.R[4]);
-	ImGui::Text("r5:  %08X", GBA.cpu.reg.R[5]);
-	ImGui::Text("r6:  %08X", GBA.cpu.reg.R[6]);
-	ImGui::Text("r7:  %08X", GBA.cpu.reg.R[7]);
-	ImGui::Text("r8:  %08X", GBA.cpu.reg.R[8]);
-	ImGui::Text("r9:  %08X", GBA.cpu.reg.R[9]);
-	ImGui::Text("r10: %08X", GBA.cpu.reg.R[10]);
-	ImGui::Text("r11: %08X", GBA.cpu.reg.R[11]);
-	ImGui::Text("r12: %08X", GBA.cpu.reg.R[12]);
-	ImGui::Text("r13: %08X", GBA.cpu.reg.R[13]);
-	ImGui::Text("r14: %08X", GBA.cpu.reg.R[14]);
-	ImGui::Text("r15: %08X", GBA.cpu.reg.R[15]);
-	ImGui::Text("CPSR: %08X", GBA.cpu.reg.CPSR);
+	ImGui::Text("r0:  %08X", gba.cpu.reg.R[0]);
+	ImGui::Text("r1:  %08X", gba.cpu.reg.R[1]);
+	ImGui::Text("r2:  %08X", gba.cpu.reg.R[2]);
+	ImGui::Text("r3:  %08X", gba.cpu.reg.R[3]);
+	ImGui::Text("r4:  %08X", gba.cpu.reg.R[4]);
+	ImGui::Text("r5:  %08X", gba.cpu.reg.R[5]);
+	ImGui::Text("r6:  %08X", gba.cpu.reg.R[6]);
+	ImGui::Text("r7:  %08X", gba.cpu.reg.R[7]);
+	ImGui::Text("r8:  %08X", gba.cpu.reg.R[8]);
+	ImGui::Text("r9:  %08X", gba.cpu.reg.R[9]);
+	ImGui::Text("r10: %08X", gba.cpu.reg.R[10]);
+	ImGui::Text("r11: %08X", gba.cpu.reg.R[11]);
+	ImGui::Text("r12: %08X", gba.cpu.reg.R[12]);
+	ImGui::Text("r13: %08X", gba.cpu.reg.R[13]);
+	ImGui::Text("r14: %08X", gba.cpu.reg.R[14]);
+	ImGui::Text("r15: %08X", gba.cpu.reg.R[15]);
+	ImGui::Text("CPSR: %08X", gba.cpu.readCPSR());
 
 	ImGui::Spacing();
-	bool imeTmp = GBA.cpu.IME;
+	bool imeTmp = gba.cpu.IME;
 	ImGui::Checkbox("IME", &imeTmp);
 	ImGui::SameLine();
-	ImGui::Text("IE: %04X", GBA.cpu.IE);
+	ImGui::Text("IE: %04X", gba.cpu.IE);
 	ImGui::SameLine();
-	ImGui::Text("IF: %04X", GBA.cpu.IF);
+	ImGui::Text("IF: %04X", gba.cpu.IF);
 
 	ImGui::Spacing();
 	if (ImGui::Button("Show System Log"))
@@ -547,41 +657,41 @@ void cpuDebugWindow() {
 	ImGui::End();
 }
 
-void systemLogWindow() {
+void systemLogWindow(GameBoyAdvance& gba) {
 	static bool shouldAutoscroll = true;
 
 	ImGui::SetNextWindowSize(ImVec2(700, 600), ImGuiCond_FirstUseEver);
 	ImGui::Begin("System Log", &showSystemLog);
 
-	ImGui::Checkbox("Trace Instructions", (bool *)&GBA.cpu.traceInstructions);
+	ImGui::Checkbox("Trace Instructions", (bool *)&gba.cpu.traceInstructions);
 	ImGui::SameLine();
-	ImGui::Checkbox("Log Interrupts", (bool *)&GBA.cpu.logInterrupts);
+	ImGui::Checkbox("Log Interrupts", (bool *)&gba.cpu.logInterrupts);
 	ImGui::SameLine();
-	ImGui::Checkbox("Log Flash Commands", (bool *)&GBA.logFlash);
+	ImGui::Checkbox("Log Flash Commands", (bool *)&gba.logFlash);
 	ImGui::SameLine();
-	ImGui::Checkbox("Log DMAs", (bool *)&GBA.dma.logDma);
+	ImGui::Checkbox("Log DMAs", (bool *)&gba.dma.logDma);
 
 	ImGui::Spacing();
 	ImGui::Checkbox("Auto-scroll", &shouldAutoscroll);
 	ImGui::SameLine();
 	if (ImGui::Button("Clear Log")) {
-		GBA.cpu.addThreadEvent(GBACPU::CLEAR_LOG);
+		gba.cpu.addThreadEvent(GBACPU::CLEAR_LOG);
 	}
 	ImGui::SameLine();
 	if (ImGui::Button("Save Log")) {
 		std::ofstream logFileStream{"log", std::ios::trunc};
-		logFileStream << GBA.log.str();
+		logFileStream << gba.log.str();
 		logFileStream.close();
 	}
 
 	if (ImGui::TreeNode("Disassembler Options")) {
-		ImGui::Checkbox("Show AL Condition", (bool *)&disassembler.options.showALCondition);
-		ImGui::Checkbox("Always Show S Bit", (bool *)&disassembler.options.alwaysShowSBit);
-		ImGui::Checkbox("Show Operands in Hex", (bool *)&disassembler.options.printOperandsHex);
-		ImGui::Checkbox("Show Addresses in Hex", (bool *)&disassembler.options.printAddressesHex);
-		ImGui::Checkbox("Simplify Register Names", (bool *)&disassembler.options.simplifyRegisterNames);
-		ImGui::Checkbox("Simplify LDM and STM to PUSH and POP", (bool *)&disassembler.options.simplifyPushPop);
-		ImGui::Checkbox("Use Alternative Stack Suffixes for LDM and STM", (bool *)&disassembler.options.ldmStmStackSuffixes);
+		ImGui::Checkbox("Show AL Condition", (bool *)&gba.cpu.disassembler.options.showALCondition);
+		ImGui::Checkbox("Always Show S Bit", (bool *)&gba.cpu.disassembler.options.alwaysShowSBit);
+		ImGui::Checkbox("Show Operands in Hex", (bool *)&gba.cpu.disassembler.options.printOperandsHex);
+		ImGui::Checkbox("Show Addresses in Hex", (bool *)&gba.cpu.disassembler.options.printAddressesHex);
+		ImGui::Checkbox("Simplify Register Names", (bool *)&gba.cpu.disassembler.options.simplifyRegisterNames);
+		ImGui::Checkbox("Simplify LDM and STM to PUSH and POP", (bool *)&gba.cpu.disassembler.options.simplifyPushPop);
+		ImGui::Checkbox("Use Alternative Stack Suffixes for LDM and STM", (bool *)&gba.cpu.disassembler.options.ldmStmStackSuffixes);
 		ImGui::TreePop();
 	}
 
@@ -590,7 +700,7 @@ void systemLogWindow() {
 
 	if (ImGui::TreeNode("Log")) {
 		ImGui::BeginChild("Debug CPU", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
-		ImGui::TextUnformatted(GBA.log.str().c_str());
+		ImGui::TextUnformatted(gba.log.str().c_str());
 		if (shouldAutoscroll)
 			ImGui::SetScrollHereY(1.0f);
 		ImGui::EndChild();
@@ -600,7 +710,7 @@ void systemLogWindow() {
 	ImGui::End();
 }
 
-void romFileDialog() {
+void romFileDialog(GameBoyAdvance& gba) {
 	nfdfilteritem_t filter[1] = {{"Game Boy Advance ROM", "gba,bin"}};
 	NFD::UniquePath nfdRomFilePath;
 	nfdresult_t nfdResult = NFD::OpenDialog(nfdRomFilePath, filter, 1);
@@ -610,14 +720,14 @@ void romFileDialog() {
 		if (!argBiosGiven) {
 			showNoBios = true;
 		} else {
-			loadRom();
+			loadRom(gba);
 		}
 	} else if (nfdResult != NFD_CANCEL) {
 		printf("Error: %s\n", NFD::GetError());
 	}
 }
 
-void biosFileDialog() {
+void biosFileDialog(GameBoyAdvance& gba) {
 	nfdfilteritem_t filter[1] = {{"Game Boy Advance BIOS", "bin"}};
 	NFD::UniquePath nfdBiosFilePath;
 	nfdresult_t nfdResult = NFD::OpenDialog(nfdBiosFilePath, filter, 1);
@@ -626,13 +736,13 @@ void biosFileDialog() {
 		argBiosFilePath = nfdBiosFilePath.get();
 		showNoBios = false;
 		if (argRomGiven)
-			loadRom();
+			loadRom(gba);
 	} else if (nfdResult != NFD_CANCEL) {
 		printf("Error: %s\n", NFD::GetError());
 	}
 }
 
-void memEditorWindow() {
+void memEditorWindow(GameBoyAdvance& gba) {
 	ImGui::SetNextWindowSize(ImVec2(570, 400), ImGuiCond_FirstUseEver);
 	ImGui::Begin("Memory Editor", &showMemEditor);
 
@@ -662,17 +772,17 @@ void memEditorWindow() {
 	ImGui::SameLine();
 	ImGui::Checkbox("Unrestricted Writes", &memEditorUnrestrictedWrites);
 
-	memEditor.DrawContents(nullptr, 0x10000000);
+	memEditor.DrawContents(&gba, 0x10000000); // Only ever handed to memEditorRead and memEditorWrite
 
 	ImGui::End();
 }
 
 ImU8 memEditorRead(const ImU8* data, size_t off) {
-	return GBA.readDebug((u32)off);
+	return ((GameBoyAdvance *)data)->readDebug((u32)off);
 }
 
 void memEditorWrite(ImU8* data, size_t off, ImU8 d) {
-	GBA.writeDebug((u32)off, d, memEditorUnrestrictedWrites);
+	((GameBoyAdvance *)data)->writeDebug((u32)off, d, memEditorUnrestrictedWrites);
 }
 
 bool memEditorHighlight(const ImU8* data, size_t off) {
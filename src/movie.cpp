@@ -0,0 +1,209 @@
+
+#include "movie.hpp"
+#include "gba.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+
+GBAMovie::GBAMovie(GameBoyAdvance& bus_) : bus(bus_) {
+	mode = MOVIE_OFF;
+	endTime = UINT64_MAX;
+}
+
+void GBAMovie::reset() {
+	switch (mode) {
+	case MOVIE_RECORDING:
+		inputs.clear();
+		break;
+	case MOVIE_PLAYING:
+		scheduleNextInput(0);
+		break;
+	default:
+		break;
+	}
+}
+
+void GBAMovie::onStateLoaded() {
+	switch (mode) {
+	case MOVIE_RECORDING: // Anything after this point didn't happen anymore
+		while (!inputs.empty() && (inputs.back().time > bus.cpu.currentTime))
+			inputs.pop_back();
+		break;
+	case MOVIE_PLAYING: // The state might not have come from this movie, so find our place again
+		scheduleNextInput(bus.cpu.currentTime);
+		break;
+	default:
+		bus.cpu.cancel(GBACPU::EVENT_MOVIE_INPUT);
+		break;
+	}
+}
+
+void GBAMovie::startRecording() {
+	mode = MOVIE_RECORDING;
+	inputs.clear();
+	endTime = UINT64_MAX;
+	bus.cpu.cancel(GBACPU::EVENT_MOVIE_INPUT);
+}
+
+int GBAMovie::stopRecording(std::filesystem::path movieFilePath) {
+	if (mode != MOVIE_RECORDING)
+		return -1;
+
+	endTime = bus.cpu.currentTime;
+	mode = MOVIE_OFF;
+	return saveMovie(movieFilePath);
+}
+
+int GBAMovie::startPlayback(std::filesystem::path movieFilePath) {
+	if (loadMovie(movieFilePath))
+		return -1;
+
+	mode = MOVIE_PLAYING;
+	return 0;
+}
+
+void GBAMovie::stop() {
+	mode = MOVIE_OFF;
+	bus.cpu.cancel(GBACPU::EVENT_MOVIE_INPUT);
+}
+
+void GBAMovie::recordInput() {
+	if (mode != MOVIE_RECORDING)
+		return;
+
+	u16 keys = ~bus.KEYINPUT & 0x3FF;
+	if (!inputs.empty() && (inputs.back().time == bus.cpu.currentTime)) {
+		inputs.back().keys = keys;
+	} else {
+		inputs.push_back({bus.cpu.currentTime, keys});
+	}
+}
+
+void GBAMovie::playInput() {
+	// Use the last change at or before now instead of keeping an index, so loading a state can't put the movie out of sync
+	u64 now = bus.cpu.currentTime;
+	auto next = std::upper_bound(inputs.begin(), inputs.end(), now, [](u64 time, const InputChange& change) { return time < change.time; });
+	if (next != inputs.begin())
+		bus.KEYINPUT = ~std::prev(next)->keys & 0x3FF;
+
+	if (now >= endTime) {
+		if (!bus.cpu.runningAhead) { // Those frames get rolled back, and the movie has to still be playing when they are run for real
+			mode = MOVIE_OFF;
+			bus.log << "Movie finished\n";
+		}
+		return;
+	}
+	scheduleNextInput(now + 1);
+}
+
+void GBAMovie::scheduleNextInput(u64 after) { // Schedules the first change at or after the given time
+	auto next = std::lower_bound(inputs.begin(), inputs.end(), after, [](const InputChange& change, u64 time) { return change.time < time; });
+	u64 time = (next != inputs.end()) ? std::min(next->time, endTime) : endTime;
+
+	if (time == UINT64_MAX) {
+		bus.cpu.cancel(GBACPU::EVENT_MOVIE_INPUT);
+	} else {
+		bus.cpu.reschedule(GBACPU::EVENT_MOVIE_INPUT, time);
+	}
+}
+
+// Movie files are plain text:
+// ecnavdA-yoBemaG movie 1
+// rom <ROM size> <ROM header from 0xA0 to 0xBF in hex>
+// hle <1 if the HLE BIOS was used>
+// <cycle> <pressed buttons in hex, same bit order as KEYINPUT>
+// ...
+// end <cycle>
+// Cycles count from reset, so the frame a change lands on is cycle / 280896.
+static const char movieMagic[] = "ecnavdA-yoBemaG movie 1";
+
+static std::string romHeaderString(GameBoyAdvance& bus) {
+	std::string out;
+	for (int i = 0xA0; (i < 0xC0) && (i < (int)bus.romBuff.size()); i++)
+		out += fmt::format("{:0>2X}", bus.romBuff[i]);
+
+	return out;
+}
+
+bool GBAMovie::isMovieFile(std::filesystem::path movieFilePath) {
+	std::ifstream movieFileStream{movieFilePath};
+	std::string line;
+	return std::getline(movieFileStream, line) && (line == movieMagic);
+}
+
+int GBAMovie::saveMovie(std::filesystem::path movieFilePath) {
+	std::ofstream movieFileStream{movieFilePath, std::ios::trunc};
+	if (!movieFileStream) {
+		printf("Failed to open/create movie file: %s\n", movieFilePath.c_str());
+		return -1;
+	}
+
+	movieFileStream << movieMagic << "\n";
+	movieFileStream << fmt::format("rom {} {}\n", bus.romSize, romHeaderString(bus));
+	movieFileStream << fmt::format("hle {}\n", (int)bus.cpu.hleBios);
+	for (auto& change : inputs)
+		movieFileStream << fmt::format("{} {:0>3X}\n", change.time, change.keys);
+	movieFileStream << fmt::format("end {}\n", endTime);
+	movieFileStream.close();
+
+	bus.log << "Saved movie to " << movieFilePath << "\n";
+	return 0;
+}
+
+int GBAMovie::loadMovie(std::filesystem::path movieFilePath) {
+	std::ifstream movieFileStream{movieFilePath};
+	if (!movieFileStream.is_open()) {
+		printf("Failed to open movie file: %s\n", movieFilePath.c_str());
+		return -1;
+	}
+
+	std::string line;
+	if (!std::getline(movieFileStream, line) || (line != movieMagic)) {
+		printf("Not a movie file: %s\n", movieFilePath.c_str());
+		return -1;
+	}
+
+	std::vector<InputChange> newInputs;
+	u64 newEndTime = UINT64_MAX;
+	while (std::getline(movieFileStream, line)) {
+		std::istringstream lineStream{line};
+		std::string first;
+		if (!(lineStream >> first))
+			continue;
+
+		if (first == "rom") {
+			int size;
+			std::string header;
+			lineStream >> size >> header;
+			if ((size != bus.romSize) || (header != romHeaderString(bus))) {
+				printf("Movie was recorded with a different ROM\n");
+				return -1;
+			}
+		} else if (first == "hle") {
+			int hle;
+			lineStream >> hle;
+			if ((bool)hle != bus.cpu.hleBios) // Still worth trying, but it probably won't stay in sync
+				bus.log << "Movie was recorded with " << (hle ? "the HLE BIOS" : "a BIOS file") << "\n";
+		} else if (first == "end") {
+			lineStream >> newEndTime;
+		} else {
+			InputChange change;
+			unsigned int keys;
+			char *numberEnd;
+			change.time = strtoull(first.c_str(), &numberEnd, 10);
+			if (*numberEnd || !(lineStream >> std::hex >> keys))
+				continue;
+			change.keys = keys & 0x3FF;
+			newInputs.push_back(change);
+		}
+	}
+
+	std::stable_sort(newInputs.begin(), newInputs.end(), [](const InputChange& a, const InputChange& b) { return a.time < b.time; });
+	inputs = std::move(newInputs);
+	endTime = newEndTime;
+	return 0;
+}
@@ -2,14 +2,23 @@
 #include "ppu.hpp"
 #include "gba.hpp"
 #include "types.hpp"
+#include <algorithm>
+#include <bit>
 #include <cstdio>
 #include <locale>
 #include <cmath>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #define convertColor(x) ((x) | 0x8000)
 
-GBAPPU::GBAPPU(GameBoyAdvance& bus_) : bus(bus_) {
+GBAPPU::GBAPPU(GameBoyAdvance& bus_, bool renderOnly_) : bus(bus_), renderOnly(renderOnly_) {
 	frameCounter = 0;
+	skipDraw = false;
+	frameSkip = 0;
+	forceDrawFrame = -1;
+	linesDrawn = linesReused = 0;
 
 	reset();
 }
@@ -18,11 +27,17 @@ void GBAPPU::reset() {
 	// Clear screen
 	memset(framebuffer, 0, sizeof(framebuffer));
 	updateScreen = true;
+	skipFrame = false;
+	framesSkipped = (frameSkip == frameSkipAuto) ? maxAutoFrameSkip : frameSkip; // So the first frame is drawn
 
 	// Clear memory
 	memset(paletteRam, 0, sizeof(paletteRam));
 	memset(vram, 0, sizeof(vram));
 	memset(oam, 0, sizeof(oam));
+	memset(vramVersion, 0, sizeof(vramVersion));
+	memset(paletteVersion, 0, sizeof(paletteVersion));
+	oamVersion = 0;
+	markAllMemoryDirty();
 
 	win0VertFits = win1VertFits = false;
 	internalBG2X = internalBG2Y = internalBG3X = internalBG3Y = 0;
@@ -42,24 +57,167 @@ void GBAPPU::reset() {
 	WININ = WINOUT = 0;
 	MOSAIC = 0;
 	BLDCNT = BLDALPHA = BLDY = 0;
-	evaCoefficientFloat = evbCoefficientFloat = evyCoefficientFloat = 0;
 
-	bus.cpu.addEvent(1232, lineStartEvent, this);
-	bus.cpu.addEvent(960, hBlankEvent, this);
+	if (!renderOnly) {
+		bus.cpu.reschedule(GBACPU::EVENT_PPU_LINE_START, bus.cpu.currentTime + 1232);
+		bus.cpu.reschedule(GBACPU::EVENT_PPU_HBLANK, bus.cpu.currentTime + 960);
+	}
+}
+
+void GBAPPU::serialize(StateSerializer& state) {
+	bus.renderThread.finish(); // Lines still being drawn would end up in the framebuffer after it's saved or loaded
+
+	if (state.loading) {
+		const u8 *newFramebuffer = state.peek(sizeof(framebuffer));
+		for (int y = 0; y < 160; y++) { // Lines that come back the same can still be reused
+			if (!newFramebuffer || memcmp(framebuffer[y], newFramebuffer + (y * sizeof(framebuffer[0])), sizeof(framebuffer[0])))
+				lineKeyValid[y] = false;
+		}
+		updateScreen = true;
+	}
+	state(framebuffer);
+
+	state(win0VertFits);
+	state(win1VertFits);
+	state(internalBG2X);
+	state(internalBG2Y);
+	state(internalBG3X);
+	state(internalBG3Y);
+
+	if (state.loading) {
+		const u8 *newMemory = state.peek(sizeof(paletteRam) + sizeof(vram) + sizeof(oam));
+		if (newMemory) {
+			markChangedMemoryDirty(newMemory);
+		} else {
+			markAllMemoryDirty();
+		}
+	}
+	state(paletteRam);
+	state(vram);
+	state(oam);
+
+	state(DISPCNT);
+	state(greenSwap);
+	state(DISPSTAT);
+	state(VCOUNT);
+	state.check(VCOUNT < 228);
+	state(BG0CNT);
+	state(BG1CNT);
+	state(BG2CNT);
+	state(BG3CNT);
+	state(BG0HOFS);
+	state(BG0VOFS);
+	state(BG1HOFS);
+	state(BG1VOFS);
+	state(BG2HOFS);
+	state(BG2VOFS);
+	state(BG3HOFS);
+	state(BG3VOFS);
+	state(BG2PA);
+	state(BG2PB);
+	state(BG2PC);
+	state(BG2PD);
+	state(BG2X);
+	state(BG2Y);
+	state(BG3PA);
+	state(BG3PB);
+	state(BG3PC);
+	state(BG3PD);
+	state(BG3X);
+	state(BG3Y);
+	state(WIN0H);
+	state(WIN1H);
+	state(WIN0V);
+	state(WIN1V);
+	state(WININ);
+	state(WINOUT);
+	state(MOSAIC);
+	state(BLDCNT);
+	state(BLDALPHA);
+	state(BLDY);
+}
+
+template <typename To, typename From>
+static void copyLineState(To& to, const From& from) {
+	to.DISPCNT = from.DISPCNT;
+	to.greenSwap = from.greenSwap;
+	to.VCOUNT = from.VCOUNT;
+	to.BG0CNT = from.BG0CNT;
+	to.BG1CNT = from.BG1CNT;
+	to.BG2CNT = from.BG2CNT;
+	to.BG3CNT = from.BG3CNT;
+	to.BG0HOFS = from.BG0HOFS;
+	to.BG0VOFS = from.BG0VOFS;
+	to.BG1HOFS = from.BG1HOFS;
+	to.BG1VOFS = from.BG1VOFS;
+	to.BG2HOFS = from.BG2HOFS;
+	to.BG2VOFS = from.BG2VOFS;
+	to.BG3HOFS = from.BG3HOFS;
+	to.BG3VOFS = from.BG3VOFS;
+	to.BG2PA = from.BG2PA;
+	to.BG2PC = from.BG2PC;
+	to.BG3PA = from.BG3PA;
+	to.BG3PC = from.BG3PC;
+	to.internalBG2X = from.internalBG2X;
+	to.internalBG2Y = from.internalBG2Y;
+	to.internalBG3X = from.internalBG3X;
+	to.internalBG3Y = from.internalBG3Y;
+	to.WIN0H = from.WIN0H;
+	to.WIN1H = from.WIN1H;
+	to.WININ = from.WININ;
+	to.WINOUT = from.WINOUT;
+	to.win0VertFits = from.win0VertFits;
+	to.win1VertFits = from.win1VertFits;
+	to.MOSAIC = from.MOSAIC;
+	to.BLDCNT = from.BLDCNT;
+	to.BLDALPHA = from.BLDALPHA;
+	to.BLDY = from.BLDY;
+}
+
+void GBAPPU::saveLineState(LineState& line) {
+	copyLineState(line, *this);
+}
+
+void GBAPPU::loadLineState(const LineState& line) {
+	copyLineState(*this, line);
 }
 
-void GBAPPU::lineStartEvent(void *object) {
-	static_cast<GBAPPU *>(object)->lineStart();
+void GBAPPU::markAllMemoryDirty() {
+	markAllTilesDirty();
+	objectListsDirty = true;
+	paletteDirty = oamDirty = 0xFFFFFFFF;
+	invalidateLines();
+}
+
+void GBAPPU::markChangedMemoryDirty(const u8 *newMemory) { // Loading a state usually changes very little, so keep everything else cached
+	const u8 *newPaletteRam = newMemory;
+	const u8 *newVram = newPaletteRam + sizeof(paletteRam);
+	const u8 *newOam = newVram + sizeof(vram);
+
+	for (u32 offset = 0; offset < sizeof(paletteRam); offset += 32) {
+		if (memcmp(paletteRam + offset, newPaletteRam + offset, 32))
+			markPaletteDirty(offset);
+	}
+	for (u32 offset = 0; offset < sizeof(vram); offset += 32) {
+		if (memcmp(vram + offset, newVram + offset, 32))
+			markTileDirty(offset);
+	}
+	for (u32 offset = 0; offset < sizeof(oam); offset += 32) {
+		if (memcmp(oam + offset, newOam + offset, 32))
+			markObjectsDirty(offset);
+	}
 }
 
 void GBAPPU::lineStart() {
-	bus.cpu.addEvent(1232, lineStartEvent, this);
+	bus.cpu.reschedule(GBACPU::EVENT_PPU_LINE_START, bus.cpu.currentTime + 1232);
 
 	hBlankFlag = false;
 	++currentScanline;
 	switch (currentScanline) {
 	case 160: // VBlank
-		updateScreen = true;
+		bus.renderThread.finish();
+		if (!skipFrame)
+			updateScreen = true;
 		vBlankFlag = true;
 
 		if (vBlankIrqEnable)
@@ -73,11 +231,14 @@ void GBAPPU::lineStart() {
 	case 228: // Start of frame
 		++frameCounter;
 		currentScanline = 0;
+		if (!bus.cpu.runningAhead) // Those frames are either all drawn or all skipped along with the real one
+			chooseFrameSkip();
+		bus.renderThread.update();
 
-		internalBG2X = (float)((i32)(BG2X << 4) >> 4) / 256;
-		internalBG2Y = (float)((i32)(BG2Y << 4) >> 4) / 256;
-		internalBG3X = (float)((i32)(BG3X << 4) >> 4) / 256;
-		internalBG3Y = (float)((i32)(BG3Y << 4) >> 4) / 256;
+		internalBG2X = (i32)(BG2X << 4) >> 4;
+		internalBG2Y = (i32)(BG2Y << 4) >> 4;
+		internalBG3X = (i32)(BG3X << 4) >> 4;
+		internalBG3Y = (i32)(BG3Y << 4) >> 4;
 		break;
 	}
 
@@ -100,23 +261,33 @@ void GBAPPU::lineStart() {
 		win1VertFits = false;
 }
 
-void GBAPPU::hBlankEvent(void *object) {
-	static_cast<GBAPPU *>(object)->hBlank();
-}
-
 void GBAPPU::hBlank() {
-	bus.cpu.addEvent(1232, hBlankEvent, this);
+	bus.cpu.reschedule(GBACPU::EVENT_PPU_HBLANK, bus.cpu.currentTime + 1232);
 
 	hBlankFlag = true;
 	if (hBlankIrqEnable)
 		bus.cpu.requestInterrupt(GBACPU::IRQ_HBLANK);
 
-	if (currentScanline < 160)
-		drawScanline();
+	if (currentScanline < 160) {
+		if (!skipDraw && !skipFrame) [[likely]] {
+			if (bus.renderThread.running) {
+				bus.renderThread.captureLine();
+			} else {
+				drawScanline();
+			}
+		} else if (!forcedBlank) {
+			incrementAffineRefs();
+		}
+	}
 		bus.dma.onHBlank();
 }
 
 inline void GBAPPU::calculateWindow() {
+	if (!(window0DisplayFlag || window1DisplayFlag || windowObjDisplayFlag)) {
+		std::fill_n(windowControl, 240, 0x3F);
+		return;
+	}
+
 	bool win0HorzFits = win0Right < win0Left;
 	bool win1HorzFits = win1Right < win1Left;
 	for (int i = 0; i < 240; i++) {
@@ -131,63 +302,29 @@ inline void GBAPPU::calculateWindow() {
 
 		win0Buffer[i] = window0DisplayFlag && win0HorzFits && win0VertFits;
 		win1Buffer[i] = window1DisplayFlag && (win1HorzFits && win1VertFits) && !win0Buffer[i];
-		winObjBuffer[i] = false;
 	}
-	drawObjects(5);
-	for (int i = 0; i < 240; i++)
-		winOutBuffer[i] = !(win0Buffer[i] || win1Buffer[i] || winObjBuffer[i]);
-}
 
-inline void GBAPPU::addPixel(int x, u16 color, int layer, bool semiTransparent) {
-	Pixel *pix = &mergedBuffer[x];
-	bool fitsWindow = !(window0DisplayFlag || window1DisplayFlag || windowObjDisplayFlag) ||
-						(win0BldEnable && win0Buffer[x]) ||
-						(win1BldEnable && win1Buffer[x]) ||
-						(winObjBldEnable && winObjBuffer[x]) ||
-						(winOutBldEnable && winOutBuffer[x]);
-
-	if (pix->layer == -1) { // Drawing top pixel
-		if (fitsWindow) {
-			if ((BLDCNT & (1 << layer)) || semiTransparent) { // Make sure new pixel is first target
-				pix->oldColor = color;
-				if (blendMode == 2) {
-					// I really hope these variables get optimized out
-					int red = color & 0x1F;
-					int green = (color >> 5) & 0x1F;
-					int blue = (color >> 10) & 0x1F;
-					color = (red + (int)((31 - red) * evyCoefficientFloat)) |
-							((green + (int)((31 - green) * evyCoefficientFloat)) << 5) |
-							((blue + (int)((31 - blue) * evyCoefficientFloat)) << 10);
-				}
-				if (blendMode == 3) {
-					int red = color & 0x1F;
-					int green = (color >> 5) & 0x1F;
-					int blue = (color >> 10) & 0x1F;
-					color = (red - (int)(red * evyCoefficientFloat)) |
-							((green - (int)(green * evyCoefficientFloat)) << 5) |
-							((blue - (int)(blue * evyCoefficientFloat)) << 10);
-				}
-			}
-		}
+	// Only one window applies to each pixel
+	for (int i = 0; i < 240; i++) {
+		winOutBuffer[i] = !(win0Buffer[i] || win1Buffer[i] || winObjBuffer[i]);
 
-		pix->color = color;
-		pix->layer = layer;
-		pix->semiTransparent = semiTransparent;
-	} else if (fitsWindow && ((blendMode == 1) || pix->semiTransparent)) {
-		if ((BLDCNT & (1 << pix->layer)) || pix->semiTransparent) { // Make sure old pixel is first target
-			if (BLDCNT & (0x100 << layer)) { // Make sure new pixel is second target
-				if (pix->semiTransparent)
-					pix->color = pix->oldColor;
-				pix->color = std::min(31, (int)((pix->color & 0x1F) * evaCoefficientFloat) + (int)((color & 0x1F) * evbCoefficientFloat)) |
-						(std::min(31, (int)(((pix->color >> 5) & 0x1F) * evaCoefficientFloat) + (int)(((color >> 5) & 0x1F) * evbCoefficientFloat)) << 5) |
-						(std::min(31, (int)(((pix->color >> 10) & 0x1F) * evaCoefficientFloat) + (int)(((color >> 10) & 0x1F) * evbCoefficientFloat)) << 10);
-			}
+		if (win0Buffer[i]) {
+			windowControl[i] = WININ & 0x3F;
+		} else if (win1Buffer[i]) {
+			windowControl[i] = (WININ >> 8) & 0x3F;
+		} else if (winObjBuffer[i]) {
+			windowControl[i] = (WINOUT >> 8) & 0x3F;
+		} else {
+			windowControl[i] = WINOUT & 0x3F;
 		}
-		pix->layer = layer;
-		pix->semiTransparent = semiTransparent;
 	}
 }
 
+inline void GBAPPU::startLayer(int layer) {
+	activeLayers |= 1 << layer;
+	std::fill_n(layerKey[layer], 240, transparentKey);
+}
+
 static const unsigned int objSizeArray[4][4][2] = {
 	{{8, 8}, {16, 16}, {32, 32}, {64, 64}},
 	{{16, 8}, {32, 8}, {32, 16}, {64, 32}},
@@ -195,131 +332,126 @@ static const unsigned int objSizeArray[4][4][2] = {
 	{{0, 0}, {0, 0}, {0, 0}, {0, 0}}
 };
 
-void GBAPPU::drawObjects(int priority) {
+void GBAPPU::buildObjectLists() {
+	memset(lineObjectCount, 0, sizeof(lineObjectCount));
+
+	for (int objNo = 0; objNo < 128; objNo++) {
+		Object *obj = &objects[objNo];
+		if (obj->objMode == 2) // Disabled
+			continue;
+
+		unsigned int ySize = objSizeArray[obj->shape][obj->size][1] << (obj->objMode == 3);
+		for (unsigned int row = 0; row < ySize; row++) {
+			u8 line = obj->objY + row; // Objects wrap around from the bottom of the screen
+			if (line < 160)
+				lineObjects[line][lineObjectCount[line]++] = objNo;
+		}
+	}
+
+	objectListsDirty = false;
+}
+
+void GBAPPU::drawObjects() { // Draws the object layer and the object window in one pass
+	std::fill_n(winObjBuffer, 240, false);
 	if (!screenDisplayObj)
 		return;
-	bool drawWin = priority == 5;
-	if (drawWin && !windowObjDisplayFlag)
-		return;
+	startLayer(4);
+
+	if (objectListsDirty)
+		buildObjectLists();
 
 	int tileRowAddress = 0;
 	int tileDataAddress = 0;
 	u8 tileData = 0;
 
-	for (int objNo = 0; objNo < 128; objNo++) {
-		Object *obj = &objects[objNo];
-		if ((((obj->priority == priority) && (obj->gfxMode != 2)) || (drawWin && (obj->gfxMode == 2))) && (obj->objMode != 2)) {
-			ObjectMatrix mat = objectMatrices[obj->affineIndex];
-			unsigned int xSize = objSizeArray[obj->shape][obj->size][0];
-			unsigned int ySize = objSizeArray[obj->shape][obj->size][1];
-
-			unsigned int x = obj->objX;
-			u8 y = currentScanline - obj->objY;
-			u8 mosY = (obj->mosaic ? (currentScanline - (currentScanline % (objMosV + 1))) : currentScanline) - obj->objY;
-			int yMod = obj->verticalFlip ? (7 - (mosY % 8)) : (mosY % 8);
-
-			float affX = 0;
-			float affY = 0;
-			float pa = (float)mat.pa / 256;
-			float pb = (float)mat.pb / 256;
-			float pc = (float)mat.pc / 256;
-			float pd = (float)mat.pd / 256;
-			if (obj->objMode == 1) { // Affine
-				affX = (pb * (y - ((float)ySize / 2))) + (pa * ((float)xSize / -2)) + ((float)xSize / 2);
-				affY = (pd * (y - ((float)ySize / 2))) + (pc * ((float)xSize / -2)) + ((float)ySize / 2);
-			} else if (obj->objMode == 3) { // Affine double size
-				affX = (pb * (y - (float)ySize)) + (pa * ((float)xSize * -1)) + ((float)xSize / 2);
-				affY = (pd * (y - (float)ySize)) + (pc * ((float)xSize * -1)) + ((float)ySize / 2);
-
-				ySize <<= 1;
-			}
+	for (int listIndex = 0; listIndex < lineObjectCount[currentScanline]; listIndex++) {
+		Object *obj = &objects[lineObjects[currentScanline][listIndex]];
+		bool window = obj->gfxMode == 2;
+		if (window && !windowObjDisplayFlag)
+			continue;
 
-			if ((obj->objY + ySize) > 255) { // Decide if object is on this scanline
-				if ((currentScanline < obj->objY) && (currentScanline >= (u8)(obj->objY + ySize)))
-					continue;
-			} else {
-				if ((currentScanline < obj->objY) || (currentScanline >= (obj->objY + ySize)))
-					continue;
-			}
+		u16 key = obj->priority * 8;
+		const ObjectMatrix& mat = objectMatrices[obj->affineIndex];
+		unsigned int xSize = objSizeArray[obj->shape][obj->size][0];
+		unsigned int ySize = objSizeArray[obj->shape][obj->size][1];
+
+		unsigned int x = obj->objX;
+		u8 y = currentScanline - obj->objY;
+		u8 mosY = (obj->mosaic ? (currentScanline - (currentScanline % (objMosV + 1))) : currentScanline) - obj->objY;
+		int yMod = obj->verticalFlip ? (7 - (mosY % 8)) : (mosY % 8);
+
+		// Texture coordinates in 20.8 fixed point, starting from the left edge of the object
+		int halfWidth = xSize / 2;
+		int halfHeight = ySize / 2;
+		i32 affX = 0;
+		i32 affY = 0;
+		if (obj->objMode == 1) { // Affine
+			affX = (mat.pb * (y - halfHeight)) + (mat.pa * -halfWidth) + (halfWidth << 8);
+			affY = (mat.pd * (y - halfHeight)) + (mat.pc * -halfWidth) + (halfHeight << 8);
+		} else if (obj->objMode == 3) { // Affine double size
+			affX = (mat.pb * (y - (halfHeight * 2))) + (mat.pa * -(halfWidth * 2)) + (halfWidth << 8);
+			affY = (mat.pd * (y - (halfHeight * 2))) + (mat.pc * -(halfWidth * 2)) + (halfHeight << 8);
+		}
 
-			if (obj->objMode == 3)
-				ySize >>= 1;
-
-			for (unsigned int relX = 0; relX < (xSize << (obj->objMode == 3)); relX++) {
-				if (x < 240) {
-					if ((mergedBuffer[x].layer == -1) || ((blendMode == 1) && (mergedBuffer[x].layer != 4))) {
-						if ((obj->objMode == 1) || (obj->objMode == 3)) {
-							unsigned int mosX = floor(affX);
-							mosY = floor(affY);
-							if (obj->mosaic) {
-								mosX = mosX - (mosX % (objMosH + 1));
-								mosY = mosY - (mosY % (objMosV + 1));
-							}
-							if ((mosX < xSize) && (mosY < ySize)) {
-								tileDataAddress = 0x10000 + ((obj->tileIndex & ~(1 * obj->bpp)) * 32) + (((((int)mosY / 8) * (objMappingDimension ? (xSize / 8) : (32 >> obj->bpp))) + ((int)mosX / 8)) * (32 << obj->bpp)) + (((unsigned int)mosY & 7) * (4 << obj->bpp)) + (((unsigned int)mosX & 7) / (2 >> obj->bpp));
-
-								tileData = vram[tileDataAddress];
-								if (!obj->bpp) {
-									if (mosX & 1) {
-										tileData >>= 4;
-									} else {
-										tileData &= 0xF;
-									}
+		for (unsigned int relX = 0; relX < (xSize << (obj->objMode == 3)); relX++) {
+			if (x < 240) {
+				if (window || (key < layerKey[4][x])) { // Lower numbered objects stay in front of others with the same priority
+					if ((obj->objMode == 1) || (obj->objMode == 3)) {
+						unsigned int texX = affX >> 8;
+						unsigned int texY = (affY >> 8) & 0xFF; // Rows past 255 wrap back into the object
+						if (obj->mosaic) {
+							texX = texX - (texX % (objMosH + 1));
+							texY = texY - (texY % (objMosV + 1));
+						}
+						if ((texX < xSize) && (texY < ySize)) {
+							tileDataAddress = 0x10000 + ((obj->tileIndex & ~(1 * obj->bpp)) * 32) + ((((texY / 8) * (objMappingDimension ? (xSize / 8) : (32 >> obj->bpp))) + (texX / 8)) * (32 << obj->bpp)) + ((texY & 7) * (4 << obj->bpp)) + ((texX & 7) / (2 >> obj->bpp));
+
+							tileData = (tileDataAddress < 0x18000) ? vram[tileDataAddress] : 0;
+							if (!obj->bpp) {
+								if (texX & 1) {
+									tileData >>= 4;
+								} else {
+									tileData &= 0xF;
 								}
-							} else {
-								tileData = 0;
 							}
 						} else {
-							unsigned int mosX = ((obj->mosaic ? (x - (x % (objMosH + 1))) : x) - obj->objX) & 0x1FF;
-							if ((mosX >= 0) && (mosX < xSize)) {
-								tileRowAddress = 0x10000 + ((obj->tileIndex & ~(1 * obj->bpp)) * 32) + (((((obj->verticalFlip ? (ySize - 1 - mosY) : mosY) / 8) * (objMappingDimension ? (xSize / 8) : (32 >> obj->bpp))) + ((obj->horizontalFlip ? (xSize - 1 - mosX) : mosX) / 8)) * (32 << obj->bpp)) + (yMod * (4 << obj->bpp));
-								if (((tileRowAddress <= 0x14000) && (bgMode >= 3)) || (tileRowAddress >= 0x18000))
-									break;
-
-								int xMod = obj->horizontalFlip ? (7 - (mosX % 8)) : (mosX % 8);
-								if (obj->bpp) { // 8 bits per pixel
-									tileData = vram[tileRowAddress + xMod];
-								} else { // 4 bits per pixel
-									tileData = vram[tileRowAddress + (xMod / 2)];
-
-									if (xMod & 1) {
-										tileData >>= 4;
-									} else {
-										tileData &= 0xF;
-									}
-								}
-							} else {
-								tileData = 0;
+							tileData = 0;
+						}
+					} else {
+						unsigned int mosX = ((obj->mosaic ? (x - (x % (objMosH + 1))) : x) - obj->objX) & 0x1FF;
+						if (mosX < xSize) {
+							tileRowAddress = 0x10000 + ((obj->tileIndex & ~(1 * obj->bpp)) * 32) + (((((obj->verticalFlip ? (ySize - 1 - mosY) : mosY) / 8) * (objMappingDimension ? (xSize / 8) : (32 >> obj->bpp))) + ((obj->horizontalFlip ? (xSize - 1 - mosX) : mosX) / 8)) * (32 << obj->bpp)) + (yMod * (4 << obj->bpp));
+							if (((tileRowAddress <= 0x14000) && (bgMode >= 3)) || (tileRowAddress >= 0x18000))
+								break;
+
+							int xMod = obj->horizontalFlip ? (7 - (mosX % 8)) : (mosX % 8);
+							if (obj->bpp) { // 8 bits per pixel
+								tileData = vram[tileRowAddress + xMod];
+							} else { // 4 bits per pixel
+								tileData = decodedTile(tileRowAddress, false)[(tileRowAddress >> 2) & 7] >> (xMod * 8);
 							}
+						} else {
+							tileData = 0;
 						}
+					}
 
-						if (drawWin) {
-							// Pixel is in object window if non-transparent and not in win0 or win1
-							if (tileData &&
-								!(window0DisplayFlag && win0Buffer[x]) &&
-								!(window1DisplayFlag && win1Buffer[x])) {
-								winObjBuffer[x] = true;
-							}
+					if (tileData) {
+						if (window) {
+							winObjBuffer[x] = true;
 						} else {
-							if (tileData) {
-								if (!(window0DisplayFlag || window1DisplayFlag || windowObjDisplayFlag) ||
-									(win0ObjEnable && win0Buffer[x]) ||
-									(win1ObjEnable && win1Buffer[x]) ||
-									(winObjObjEnable && winObjBuffer[x]) ||
-									(winOutObjEnable && winOutBuffer[x])) {
-									addPixel(x, paletteColors[0x100 | ((obj->palette << 4) * !obj->bpp) | tileData], 4, (obj->gfxMode == 1));
-								}
-							}
+							layerColor[4][x] = paletteColors[0x100 | ((obj->palette << 4) * !obj->bpp) | tileData];
+							layerKey[4][x] = key;
+							objSemiTransparent[x] = (obj->gfxMode == 1) ? 0xFFFF : 0;
 						}
 					}
 				}
+			}
 
-				if ((obj->objMode == 1) || (obj->objMode == 3)) {
-					affX += pa;
-					affY += pc;
-				}
-				x = (x + 1) & 0x1FF;
+			if ((obj->objMode == 1) || (obj->objMode == 3)) {
+				affX += mat.pa;
+				affY += mat.pc;
 			}
+			x = (x + 1) & 0x1FF;
 		}
 	}
 }
@@ -364,6 +496,84 @@ constexpr std::array<int (GBAPPU::*)(int, int), 16> tilemapIndexLUT = {
 	&GBAPPU::calculateTilemapIndex<3, 3>
 };
 
+const u64 *GBAPPU::decodedTile(u32 offset, bool horizontalFlip) {
+	u32 tile = offset >> 5;
+	u64& dirtyBits = tileCacheDirty[tile >> 6];
+	u64 bit = (u64)1 << (tile & 63);
+	if (dirtyBits & bit) [[unlikely]] {
+		for (int row = 0; row < 8; row++) {
+			u32 data;
+			memcpy(&data, &vram[(tile * 32) + (row * 4)], 4);
+
+			// Spread the 8 nibbles out to one per byte, first pixel in the lowest byte
+			u64 pixels = data;
+			pixels = (pixels | (pixels << 16)) & 0x0000FFFF0000FFFF;
+			pixels = (pixels | (pixels << 8)) & 0x00FF00FF00FF00FF;
+			pixels = (pixels | (pixels << 4)) & 0x0F0F0F0F0F0F0F0F;
+			tileCache[tile][0][row] = pixels;
+			tileCache[tile][1][row] = __builtin_bswap64(pixels);
+		}
+		dirtyBits &= ~bit;
+	}
+
+	return tileCache[tile][horizontalFlip];
+}
+
+// Adds each tile's palette bank to every pixel of a 4bpp line that isn't transparent, and sets a bit in opaque for each of those pixels
+static void applyPaletteBanks(u8 *line, const u8 *banks, u32 *opaque) {
+#if defined(__AVX2__)
+	const __m256i zero = _mm256_setzero_si256();
+	for (int i = 0; i < 8; i++) {
+		__m256i pixels = _mm256_load_si256((const __m256i *)&line[i * 32]);
+		__m256i transparent = _mm256_cmpeq_epi8(pixels, zero);
+		pixels = _mm256_or_si256(pixels, _mm256_andnot_si256(transparent, _mm256_load_si256((const __m256i *)&banks[i * 32])));
+
+		_mm256_store_si256((__m256i *)&line[i * 32], pixels);
+		opaque[i] = ~(u32)_mm256_movemask_epi8(transparent);
+	}
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < 8; i++) {
+		u32 mask = 0;
+		for (int half = 0; half < 2; half++) {
+			__m128i pixels = _mm_load_si128((const __m128i *)&line[(i * 32) + (half * 16)]);
+			__m128i transparent = _mm_cmpeq_epi8(pixels, zero);
+			pixels = _mm_or_si128(pixels, _mm_andnot_si128(transparent, _mm_load_si128((const __m128i *)&banks[(i * 32) + (half * 16)])));
+
+			_mm_store_si128((__m128i *)&line[(i * 32) + (half * 16)], pixels);
+			mask |= (u32)(~_mm_movemask_epi8(transparent) & 0xFFFF) << (half * 16);
+		}
+		opaque[i] = mask;
+	}
+#else
+	memset(opaque, 0, 8 * sizeof(u32));
+	for (int i = 0; i < 256; i++) {
+		if (line[i]) {
+			line[i] |= banks[i];
+			opaque[i / 32] |= (u32)1 << (i % 32);
+		}
+	}
+#endif
+}
+
+// Sets a bit in opaque for every pixel of an 8bpp line that isn't transparent
+static void findOpaquePixels(const u8 *line, u32 *opaque) {
+#if defined(__AVX2__)
+	for (int i = 0; i < 8; i++)
+		opaque[i] = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *)&line[i * 32]), _mm256_setzero_si256()));
+#elif defined(__SSE2__)
+	for (int i = 0; i < 8; i++) {
+		u32 low = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)&line[i * 32]), _mm_setzero_si128())) & 0xFFFF;
+		u32 high = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)&line[(i * 32) + 16]), _mm_setzero_si128())) & 0xFFFF;
+		opaque[i] = low | (high << 16);
+	}
+#else
+	memset(opaque, 0, 8 * sizeof(u32));
+	for (int i = 0; i < 256; i++)
+		opaque[i / 32] |= (u32)(line[i] != 0) << (i % 32);
+#endif
+}
+
 template <int bgNum>
 void GBAPPU::drawBgTile() {
 	int xOffset;
@@ -372,7 +582,7 @@ void GBAPPU::drawBgTile() {
 	bool bpp;
 	int characterBaseBlock;
 	bool mosaic;
-	u16 winRegMask;
+	u16 key;
 	switch (bgNum) {
 	case 0:
 		if (!screenDisplayBg0) return;
@@ -382,7 +592,7 @@ void GBAPPU::drawBgTile() {
 		bpp = bg0Bpp;
 		characterBaseBlock = bg0CharacterBaseBlock;
 		mosaic = bg0Mosaic;
-		winRegMask = 0x01;
+		key = (bg0Priority * 8) + 1 + 0;
 		break;
 	case 1:
 		if (!screenDisplayBg1) return;
@@ -392,7 +602,7 @@ void GBAPPU::drawBgTile() {
 		bpp = bg1Bpp;
 		characterBaseBlock = bg1CharacterBaseBlock;
 		mosaic = bg1Mosaic;
-		winRegMask = 0x02;
+		key = (bg1Priority * 8) + 1 + 1;
 		break;
 	case 2:
 		if (!screenDisplayBg2) return;
@@ -402,7 +612,7 @@ void GBAPPU::drawBgTile() {
 		bpp = bg2Bpp;
 		characterBaseBlock = bg2CharacterBaseBlock;
 		mosaic = bg2Mosaic;
-		winRegMask = 0x04;
+		key = (bg2Priority * 8) + 1 + 2;
 		break;
 	case 3:
 		if (!screenDisplayBg3) return;
@@ -412,66 +622,138 @@ void GBAPPU::drawBgTile() {
 		bpp = bg3Bpp;
 		characterBaseBlock = bg3CharacterBaseBlock;
 		mosaic = bg3Mosaic;
-		winRegMask = 0x08;
+		key = (bg3Priority * 8) + 1 + 3;
 		break;
 	}
+	startLayer(bgNum);
 
-	int paletteBank = 0;
-	bool verticalFlip = false;
-	bool horizontalFlip = false;
-	int tileIndex = 0;
-	int tileRowAddress = 0;
-
-	int x = xOffset;
-	int mosX;
 	int y = currentScanline + yOffset;
-	if (mosaic)
+	if (mosaic) { // Pixels can be repeated from any tile, so this still goes a pixel at a time
 		y -= y % (bgMosV + 1);
 
-	for (int i = 0; i < 240; i++, x++) {
-		if ((mergedBuffer[i].layer != -1) && !mergedBuffer[i].semiTransparent && (blendMode != 1))
-			continue;
+		int paletteBank = 0;
+		bool verticalFlip = false;
+		bool horizontalFlip = false;
+		int tileIndex = 0;
+		int tileRowAddress = 0;
+
+		int x = xOffset;
+		int mosX;
+		for (int i = 0; i < 240; i++, x++) {
+			mosX = x - (x % (bgMosH + 1));
+
+			{
+				int tilemapIndex = (this->*tilemapIndexLUT[(bgNum * 4) + screenSize])(mosX, y);
+
+				u16 tilemapEntry = (vram[tilemapIndex + 1] << 8) | vram[tilemapIndex];
+				paletteBank = (tilemapEntry >> 8) & 0xF0;
+				verticalFlip = tilemapEntry & 0x0800;
+				horizontalFlip = tilemapEntry & 0x0400;
+				tileIndex = tilemapEntry & 0x3FF;
 
-		mosX = mosaic ? (x - (x % (bgMosH + 1))) : x;
+				int yMod = verticalFlip ? (7 - (y % 8)) : (y % 8);
+				tileRowAddress = (characterBaseBlock * 0x4000) + (tileIndex * (32 << bpp)) + (yMod * (4 << bpp));
+			}
+			if (tileRowAddress >= 0x10000)
+				continue;
+
+			u8 tileData;
+			int xMod = horizontalFlip ? (7 - (mosX % 8)) : (mosX % 8);
+			if (bpp) { // 8 bits per pixel
+				tileData = vram[tileRowAddress + xMod];
+			} else { // 4 bits per pixel
+				tileData = decodedTile(tileRowAddress, false)[(tileRowAddress >> 2) & 7] >> (xMod * 8);
+			}
 
-		{
-			int tilemapIndex = (this->*tilemapIndexLUT[(bgNum * 4) + screenSize])(mosX, y);
+			if (tileData) {
+				layerColor[bgNum][i] = paletteColors[(paletteBank * !bpp) | tileData];
+				layerKey[bgNum][i] = key;
+			}
+		}
+		return;
+	}
 
-			u16 tilemapEntry = (vram[tilemapIndex + 1] << 8) | vram[tilemapIndex];
-			paletteBank = (tilemapEntry >> 8) & 0xF0;
-			verticalFlip = tilemapEntry & 0x0800;
-			horizontalFlip = tilemapEntry & 0x0400;
-			tileIndex = tilemapEntry & 0x3FF;
+	// Fetch each tile's row once. The line starts at the tile the scroll lands in, so pixel i on screen is line[fineX + i].
+	alignas(32) u8 line[256];
+	alignas(32) u8 banks[256];
+	u32 opaque[8];
+	int fineX = xOffset & 7;
+	int yMod = y % 8;
+	for (int tile = 0; tile < 32; tile++) {
+		int tilemapIndex = (this->*tilemapIndexLUT[(bgNum * 4) + screenSize])((xOffset & ~7) + (tile * 8), y);
+		u16 tilemapEntry = (vram[tilemapIndex + 1] << 8) | vram[tilemapIndex];
+		int tileRowAddress = (characterBaseBlock * 0x4000) + ((tilemapEntry & 0x3FF) * (32 << bpp)) + (((tilemapEntry & 0x0800) ? (7 - yMod) : yMod) * (4 << bpp));
+
+		if (bpp) { // 8 bits per pixel, already one byte per pixel
+			u64 row = 0;
+			if (tileRowAddress < 0x10000)
+				memcpy(&row, &vram[tileRowAddress], 8);
+			if (tilemapEntry & 0x0400) // Horizontal flip
+				row = __builtin_bswap64(row);
+			memcpy(&line[tile * 8], &row, 8);
+		} else { // 4 bits per pixel
+			u64 row = 0;
+			if (tileRowAddress < 0x10000)
+				row = decodedTile(tileRowAddress, tilemapEntry & 0x0400)[(tileRowAddress >> 2) & 7];
+			memcpy(&line[tile * 8], &row, 8);
 
-			int yMod = verticalFlip ? (7 - (y % 8)) : (y % 8);
-			tileRowAddress = (characterBaseBlock * 0x4000) + (tileIndex * (32 << bpp)) + (yMod * (4 << bpp));
+			u64 bank = ((tilemapEntry >> 8) & 0xF0) * 0x0101010101010101;
+			memcpy(&banks[tile * 8], &bank, 8);
 		}
-		if (tileRowAddress >= 0x10000)
+	}
+	if (bpp) {
+		findOpaquePixels(line, opaque);
+	} else {
+		applyPaletteBanks(line, banks, opaque);
+	}
+
+	// Only visit opaque pixels
+	int lineEnd = fineX + 240;
+	for (int pos = fineX; pos < lineEnd; pos++) {
+		u32 bits = opaque[pos >> 5] >> (pos & 31);
+		if (!bits) {
+			pos |= 31;
 			continue;
+		}
+		pos += __builtin_ctz(bits);
+		if (pos >= lineEnd)
+			break;
 
-		u8 tileData;
-		int xMod = horizontalFlip ? (7 - (mosX % 8)) : (mosX % 8);
-		if (bpp) { // 8 bits per pixel
-			tileData = vram[tileRowAddress + xMod];
-		} else { // 4 bits per pixel
-			tileData = vram[tileRowAddress + (xMod / 2)];
+		int i = pos - fineX;
+		layerColor[bgNum][i] = paletteColors[line[pos]];
+		layerKey[bgNum][i] = key;
+	}
+}
 
-			if (xMod & 1) {
-				tileData >>= 4;
-			} else {
-				tileData &= 0xF;
-			}
+typedef i32 i32x8 __attribute__ ((vector_size(32)));
+typedef u32 u32x8 __attribute__ ((vector_size(32)));
+
+// Steps the reference point across the line 8 pixels at a time, then wraps or clips every texel at once
+void GBAPPU::calculateAffineCoords(i32 refX, i32 refY, i16 pa, i16 pc, bool mosaic, int width, int height, bool wrapping) {
+	const i32x8 laneOffsets = {0, 1, 2, 3, 4, 5, 6, 7};
+	i32x8 affX = refX + (laneOffsets * pa);
+	i32x8 affY = refY + (laneOffsets * pc);
+
+	for (int i = 0; i < 240; i += 8, affX += pa * 8, affY += pc * 8) {
+		i32x8 texX = (affX + ((affX >> 31) & 0xFF)) >> 8; // Round toward zero, like the float version did
+		i32x8 texY = (affY + ((affY >> 31) & 0xFF)) >> 8;
+		if (mosaic) {
+			texX -= texX % (bgMosH + 1);
+			texY -= texY % (bgMosV + 1);
 		}
 
-		if (tileData) {
-			if (!(window0DisplayFlag || window1DisplayFlag || windowObjDisplayFlag) ||
-				((WININ & winRegMask) && win0Buffer[i]) ||
-				((WININ & (winRegMask << 8)) && win1Buffer[i]) ||
-				((WINOUT & (winRegMask << 8)) && winObjBuffer[i]) ||
-				((WINOUT & winRegMask) && winOutBuffer[i])) {
-				addPixel(i, paletteColors[(paletteBank * !bpp) | tileData], bgNum, false);
-			}
+		i32x8 visible;
+		if (wrapping) { // Only used by affine BGs, which are always a power of 2 in size
+			texX &= width - 1;
+			texY &= height - 1;
+			visible = i32x8{} - 1;
+		} else {
+			visible = ((u32x8)texX < (u32)width) & ((u32x8)texY < (u32)height);
 		}
+
+		memcpy(&affineX[i], &texX, sizeof(texX));
+		memcpy(&affineY[i], &texY, sizeof(texY));
+		memcpy(&affineVisible[i], &visible, sizeof(visible));
 	}
 }
 
@@ -480,13 +762,9 @@ void GBAPPU::drawBgAffine() {
 	int characterBaseBlock;
 	int screenBaseBlock;
 	bool wrapping;
-	unsigned int screenSize;
+	int screenSize;
 	bool mosaic;
-	float affX;
-	float affY;
-	float pa;
-	float pc;
-	u16 winRegMask;
+	u16 key;
 	if (bgNum == 2) {
 		if (!screenDisplayBg2) return;
 		characterBaseBlock = bg2CharacterBaseBlock;
@@ -494,11 +772,8 @@ void GBAPPU::drawBgAffine() {
 		wrapping = bg2Wrapping;
 		screenSize = 128 << bg2ScreenSize;
 		mosaic = bg0Mosaic;
-		affX = internalBG2X;
-		affY = internalBG2Y;
-		pa = (float)BG2PA / 256;
-		pc = (float)BG2PC / 256;
-		winRegMask = 0x04;
+		key = (bg2Priority * 8) + 1 + 2;
+		calculateAffineCoords(internalBG2X, internalBG2Y, BG2PA, BG2PC, mosaic, screenSize, screenSize, wrapping);
 	} else if (bgNum == 3) {
 		if (!screenDisplayBg3) return;
 		characterBaseBlock = bg3CharacterBaseBlock;
@@ -506,36 +781,26 @@ void GBAPPU::drawBgAffine() {
 		wrapping = bg3Wrapping;
 		screenSize = 128 << bg3ScreenSize;
 		mosaic = bg0Mosaic;
-		affX = internalBG3X;
-		affY = internalBG3Y;
-		pa = (float)BG3PA / 256;
-		pc = (float)BG3PC / 256;
-		winRegMask = 0x08;
+		key = (bg3Priority * 8) + 1 + 3;
+		calculateAffineCoords(internalBG3X, internalBG3Y, BG3PA, BG3PC, mosaic, screenSize, screenSize, wrapping);
 	}
+	startLayer(bgNum);
 
-	for (int i = 0; i < 240; i++, affX += pa, affY += pc) {
-		if ((mergedBuffer[i].layer != -1) && !mergedBuffer[i].semiTransparent && (blendMode != 1))
-			continue;
-
-		int mosX = mosaic ? ((int)affX - ((int)affX % (bgMosH + 1))) : (int)affX;
-		int mosY = mosaic ? ((int)affY - ((int)affY % (bgMosV + 1))) : (int)affY;
-		if (!wrapping && (((unsigned int)mosY >= screenSize) || ((unsigned int)mosX >= screenSize)))
+	for (int i = 0; i < 240; i++) {
+		if (!affineVisible[i])
 			continue;
 
-		int tilemapIndex = (screenBaseBlock * 0x800) + (((mosY & (screenSize - 1)) / 8) * (screenSize / 8)) + ((mosX & (screenSize - 1)) / 8);
-		int tileAddress = (characterBaseBlock * 0x4000) + (vram[tilemapIndex] * 64) + ((mosY & 7) * 8) + (mosX & 7);
+		int texX = affineX[i];
+		int texY = affineY[i];
+		int tilemapIndex = (screenBaseBlock * 0x800) + ((texY / 8) * (screenSize / 8)) + (texX / 8);
+		int tileAddress = (characterBaseBlock * 0x4000) + (vram[tilemapIndex] * 64) + ((texY & 7) * 8) + (texX & 7);
 		if (tileAddress >= 0x10000)
 			continue;
 		u8 tileData = vram[tileAddress];
 
 		if (tileData) {
-			if (!(window0DisplayFlag || window1DisplayFlag || windowObjDisplayFlag) ||
-				((WININ & winRegMask) && win0Buffer[i]) ||
-				((WININ & (winRegMask << 8)) && win1Buffer[i]) ||
-				((WINOUT & (winRegMask << 8)) && winObjBuffer[i]) ||
-				((WINOUT & winRegMask) && winOutBuffer[i])) {
-				addPixel(i, paletteColors[tileData], bgNum, false);
-			}
+			layerColor[bgNum][i] = paletteColors[tileData];
+			layerKey[bgNum][i] = key;
 		}
 	}
 }
@@ -543,111 +808,88 @@ void GBAPPU::drawBgAffine() {
 template <int mode>
 void GBAPPU::drawBgBitmap() {
 	if (!screenDisplayBg2) return;
-	float affX = internalBG2X;
-	float affY = internalBG2Y;
-	float pa = (float)BG2PA / 256;
-	float pc = (float)BG2PC / 256;
+	u16 key = (bg2Priority * 8) + 1 + 2;
+	startLayer(2);
 
-	for (int x = 0; x < 240; x++, affX += pa, affY += pc) {
-		if ((mergedBuffer[x].layer != -1) && !mergedBuffer[x].semiTransparent && (blendMode != 1))
-			continue;
+	if (mode == 5) {
+		calculateAffineCoords(internalBG2X, internalBG2Y, BG2PA, BG2PC, bg2Mosaic, 160, 128, false);
+	} else {
+		calculateAffineCoords(internalBG2X, internalBG2Y, BG2PA, BG2PC, bg2Mosaic, 240, 160, false);
+	}
 
-		int mosX = bg2Mosaic ? ((int)affX - ((int)affX % (bgMosH + 1))) : (int)affX;
-		int mosY = bg2Mosaic ? ((int)affY - ((int)affY % (bgMosV + 1))) : (int)affY;
+	for (int x = 0; x < 240; x++) {
+		if (!bg2Wrapping && !affineVisible[x]) // The wraparound bit turns clipping off
+			continue;
 
+		int texX = affineX[x];
+		int texY = affineY[x];
 		u16 vramData;
 		if (mode == 3) {
-			if (!bg2Wrapping && (((unsigned int)mosY >= 160) || ((unsigned int)mosX >= 240)))
+			u32 vramIndex = ((texY * 240) + texX) * 2;
+			if (vramIndex >= (sizeof(vram) - 1))
 				continue;
-
-			auto vramIndex = ((mosY * 240) + mosX) * 2;
 			vramData = (vram[vramIndex + 1] << 8) | vram[vramIndex];
 		} else if (mode == 4) {
-			if (!bg2Wrapping && (((unsigned int)mosY >= 160) || ((unsigned int)mosX >= 240)))
+			u32 vramIndex = ((texY * 240) + texX) + (displayFrameSelect * 0xA000);
+			if (vramIndex >= sizeof(vram))
 				continue;
-
-			auto vramIndex = ((mosY * 240) + mosX) + (displayFrameSelect * 0xA000);
 			vramData = paletteColors[vram[vramIndex]];
-		} else if (mode == 5) {
-			if (!bg2Wrapping && (((unsigned int)mosY >= 128) || ((unsigned int)mosX >= 160)))
-				continue;
-
+		} else if (mode == 5) { // Only clipped by the transform, the pixel comes from the screen position
 			auto vramIndex = (((currentScanline * 160) + x) * 2) + (displayFrameSelect * 0xA000);
 			vramData = (vram[vramIndex + 1] << 8) | vram[vramIndex];
 		}
 
-		if (!(window0DisplayFlag || window1DisplayFlag || windowObjDisplayFlag) ||
-			(win0Bg2Enable && win0Buffer[x]) ||
-			(win1Bg2Enable && win1Buffer[x]) ||
-			(winObjBg2Enable && winObjBuffer[x]) ||
-			(winOutBg2Enable && winOutBuffer[x])) {
-			addPixel(x, vramData, bg2Priority, false);
-		}
+		layerColor[2][x] = vramData;
+		layerKey[2][x] = key;
 	}
 }
 
 void GBAPPU::drawScanline() {
+	if (lineUnchanged()) { // Already in the framebuffer from the last time this line was drawn
+		++linesReused;
+		if (!forcedBlank)
+			incrementAffineRefs();
+		return;
+	}
+	++linesDrawn;
+
 	if (forcedBlank) { // I honestly just wanted an excuse to make a mildly cursed for loop
 		for (int i = 0; i < 240; framebuffer[currentScanline][i++] = 0xFFFF);
 		return;
 	}
 
-	for (int i = 0; i < 240; i++) {
-		mergedBuffer[i].layer = -1;
-		mergedBuffer[i].semiTransparent = false;
-	}
+	activeLayers = 0;
+	drawObjects();
 	calculateWindow();
 
 	switch (bgMode) {
 	case 0:
-		for (int layer = 0; layer < 4; layer++) {
-			drawObjects(layer);
-			if (bg0Priority == layer) drawBgTile<0>();
-			if (bg1Priority == layer) drawBgTile<1>();
-			if (bg2Priority == layer) drawBgTile<2>();
-			if (bg3Priority == layer) drawBgTile<3>();
-		}
+		drawBgTile<0>();
+		drawBgTile<1>();
+		drawBgTile<2>();
+		drawBgTile<3>();
 		break;
 	case 1:
-		for (int layer = 0; layer < 4; layer++) {
-			drawObjects(layer);
-			if (bg0Priority == layer) drawBgTile<0>();
-			if (bg1Priority == layer) drawBgTile<1>();
-			if (bg2Priority == layer) drawBgAffine<2>();
-		}
+		drawBgTile<0>();
+		drawBgTile<1>();
+		drawBgAffine<2>();
 		break;
 	case 2:
-		for (int layer = 0; layer < 4; layer++) {
-			drawObjects(layer);
-			if (bg2Priority == layer) drawBgAffine<2>();
-			if (bg3Priority == layer) drawBgAffine<3>();
-		}
+		drawBgAffine<2>();
+		drawBgAffine<3>();
 		break;
 	case 3:
-		for (int layer = 0; layer < 4; layer++) {
-			drawObjects(layer);
-			if (bg2Priority == layer) drawBgBitmap<3>();
-		}
+		drawBgBitmap<3>();
 		break;
 	case 4:
-		for (int layer = 0; layer < 4; layer++) {
-			drawObjects(layer);
-			if (bg2Priority == layer) drawBgBitmap<4>();
-		}
+		drawBgBitmap<4>();
 		break;
 	case 5:
-		for (int layer = 0; layer < 4; layer++) {
-			drawObjects(layer);
-			if (bg2Priority == layer) drawBgBitmap<5>();
-		}
+		drawBgBitmap<5>();
 		break;
 	}
 
-	for (int i = 0; i < 240; i++) { // Copy scanline buffer to main framebuffer
-		if (mergedBuffer[i].layer == -1)
-			addPixel(i, paletteColors[0], 5, false);
-		framebuffer[currentScanline][i] = convertColor(mergedBuffer[i].color);
-	}
+	composeLine();
 
 	if (greenSwap) { // Convert BGRbgr pattern to BgRbGr
 		for (int i = 0; i < 240; i += 2) {
@@ -659,10 +901,220 @@ void GBAPPU::drawScanline() {
 		}
 	}
 
-	internalBG2X += (float)BG2PB / 256;
-	internalBG2Y += (float)BG2PD / 256;
-	internalBG3X += (float)BG3PB / 256;
-	internalBG3Y += (float)BG3PD / 256;
+	incrementAffineRefs();
+}
+
+bool GBAPPU::lineUnchanged() {
+	LineKey key;
+	memset(&key, 0, sizeof(key)); // Padding gets compared too
+	saveLineState(key.line);
+	if (!forcedBlank) {
+		u8 blocks = lineVramBlocks();
+		for (int i = 0; i < 6; i++) {
+			if (blocks & (1 << i))
+				key.vramVersion[i] = vramVersion[i];
+		}
+		key.paletteVersion[0] = paletteVersion[0]; // The backdrop is always there
+		if (screenDisplayObj) {
+			key.paletteVersion[1] = paletteVersion[1];
+			key.oamVersion = oamVersion;
+		}
+	}
+
+	LineKey& lastKey = lineKeys[currentScanline];
+	if (lineKeyValid[currentScanline] && !memcmp(&key, &lastKey, sizeof(key)))
+		return true;
+
+	lastKey = key;
+	lineKeyValid[currentScanline] = true;
+	return false;
+}
+
+u8 GBAPPU::lineVramBlocks() { // 16KB blocks of VRAM this line could read from, erring on the side of too many
+	u8 blocks = 0;
+	auto addBlocks = [&](u32 start, u32 size) {
+		u32 end = std::min(start + size, (u32)sizeof(vram)) - 1;
+		blocks |= (2 << (end >> 14)) - (1 << (start >> 14));
+	};
+
+	if (bgMode < 3) {
+		const u16 bgControl[4] = {BG0CNT, BG1CNT, BG2CNT, BG3CNT};
+		for (int bg = 0; bg < 4; bg++) {
+			if (DISPCNT & (0x100 << bg)) {
+				addBlocks(((bgControl[bg] >> 2) & 3) * 0x4000, 0x10000); // 1024 8bpp tiles
+				addBlocks(((bgControl[bg] >> 8) & 0x1F) * 0x800, 0x4000); // Largest affine map
+			}
+		}
+	} else if (screenDisplayBg2) {
+		addBlocks(0, 0x14000);
+	}
+	if (screenDisplayObj)
+		addBlocks(0x10000, 0x8000);
+
+	return blocks;
+}
+
+#if defined(__AVX2__)
+typedef u16 u16xN __attribute__ ((vector_size(32)));
+#else
+typedef u16 u16xN __attribute__ ((vector_size(16)));
+#endif
+static constexpr int lanes = sizeof(u16xN) / sizeof(u16);
+
+static inline u16xN selectLanes(u16xN mask, u16xN a, u16xN b) {
+	return (a & mask) | (b & ~mask);
+}
+
+static inline u16xN splat(u16 value) {
+	return u16xN{} + value;
+}
+
+static inline u16xN blendChannel(u16xN a, u16xN b, u16xN eva, u16xN evb) {
+	u16xN sum = ((a * eva) >> 4) + ((b * evb) >> 4);
+	return selectLanes((u16xN)(sum > 31), splat(31), sum);
+}
+
+static inline u16xN blendColors(u16xN a, u16xN b, u16 eva, u16 evb) {
+	u16xN eva16 = splat(eva);
+	u16xN evb16 = splat(evb);
+	return blendChannel(a & 0x1F, b & 0x1F, eva16, evb16) |
+			(blendChannel((a >> 5) & 0x1F, (b >> 5) & 0x1F, eva16, evb16) << 5) |
+			(blendChannel((a >> 10) & 0x1F, (b >> 10) & 0x1F, eva16, evb16) << 10);
+}
+
+static inline u16xN changeBrightness(u16xN color, u16 evy, int blendMode) {
+	u16xN red = color & 0x1F;
+	u16xN green = (color >> 5) & 0x1F;
+	u16xN blue = (color >> 10) & 0x1F;
+	if (blendMode == 2)
+		return (red + (((31 - red) * evy) >> 4)) | ((green + (((31 - green) * evy) >> 4)) << 5) | ((blue + (((31 - blue) * evy) >> 4)) << 10);
+	if (blendMode == 3)
+		return (red - ((red * evy) >> 4)) | ((green - ((green * evy) >> 4)) << 5) | ((blue - ((blue * evy) >> 4)) << 10);
+	return color;
+}
+
+// Visits every pixel's layers front to back and blends each one into the pixel, one layer at a time.
+// GCC turns the vector types into SSE2/AVX2 code when it can, and plain loops when it can't.
+void GBAPPU::composeLine() {
+	const u16 eva = std::min((int)evaCoefficient, 16);
+	const u16 evb = std::min((int)evbCoefficient, 16);
+	const u16 evy = std::min((int)evyCoefficient, 16);
+	const u16xN alphaMode = splat((blendMode == 1) ? 0xFFFF : 0);
+	const int layerCount = std::popcount(activeLayers);
+
+	// Bitmaps use the BLDCNT bits of their priority instead of BG2's
+	u16 firstBits[5];
+	u16 secondBits[5];
+	for (int layer = 0; layer < 5; layer++) {
+		int bit = ((layer == 2) && (bgMode >= 3)) ? bg2Priority : layer;
+		firstBits[layer] = (BLDCNT & (1 << bit)) ? 0xFFFF : 0;
+		secondBits[layer] = (BLDCNT & (0x100 << bit)) ? 0xFFFF : 0;
+	}
+
+	for (int x = 0; x < 240; x += lanes) {
+		u16xN control;
+		memcpy(&control, &windowControl[x], sizeof(control));
+		u16xN effects = (u16xN)((control & 0x20) != 0);
+
+		u16xN keys[5];
+		for (int layer = 0; layer < 5; layer++) {
+			if (!(activeLayers & (1 << layer)))
+				continue;
+
+			memcpy(&keys[layer], &layerKey[layer][x], sizeof(keys[layer]));
+			keys[layer] |= (u16xN)((control & splat(1 << layer)) == 0); // Hidden by the window
+		}
+		u16xN objSemi = u16xN{};
+		if (activeLayers & 0x10)
+			memcpy(&objSemi, &objSemiTransparent[x], sizeof(objSemi));
+
+		u16xN color = u16xN{};
+		u16xN oldColor = u16xN{}; // The top color from before its brightness effect
+		u16xN lastKey = u16xN{};
+		u16xN lastFirst = u16xN{};
+		u16xN lastSemi = u16xN{};
+		u16xN started = u16xN{};
+		for (int round = 0; round < layerCount; round++) {
+			// Find the next layer back
+			u16xN key = splat(transparentKey);
+			u16xN nextColor = u16xN{};
+			u16xN first = u16xN{};
+			u16xN second = u16xN{};
+			u16xN semi = u16xN{};
+			for (int layer = 0; layer < 5; layer++) {
+				if (!(activeLayers & (1 << layer)))
+					continue;
+
+				u16xN next = ((u16xN)(keys[layer] > lastKey) | ~started) & (u16xN)(keys[layer] < key);
+				u16xN layerColors;
+				memcpy(&layerColors, &layerColor[layer][x], sizeof(layerColors));
+				u16xN layerSemi = (layer == 4) ? objSemi : u16xN{};
+				key = selectLanes(next, keys[layer], key);
+				nextColor = selectLanes(next, layerColors, nextColor);
+				first = selectLanes(next, splat(firstBits[layer]), first);
+				second = selectLanes(next, splat(secondBits[layer]), second);
+				semi = selectLanes(next, layerSemi, semi);
+			}
+			u16xN valid = (u16xN)(key != transparentKey);
+
+			// The top layer only gets the brightness effect
+			u16xN top = valid & ~started;
+			u16xN topEffects = top & effects & (first | semi);
+			oldColor = selectLanes(topEffects, nextColor, oldColor);
+			color = selectLanes(top, selectLanes(topEffects, changeBrightness(nextColor, evy, blendMode), nextColor), color);
+
+			// Layers behind it blend into whatever is there
+			u16xN behind = valid & started & effects & (alphaMode | lastSemi);
+			u16xN blend = behind & (lastFirst | lastSemi) & second;
+			color = selectLanes(blend, blendColors(selectLanes(lastSemi, oldColor, color), nextColor, eva, evb), color);
+
+			u16xN visited = top | behind;
+			lastFirst = selectLanes(visited, first, lastFirst);
+			lastSemi = selectLanes(visited, semi, lastSemi);
+			lastKey = selectLanes(valid, key, lastKey);
+			started |= valid;
+		}
+
+		// The backdrop only shows where nothing else was drawn
+		u16xN backdrop = splat(paletteColors[0]);
+		if (aBd)
+			backdrop = selectLanes(effects, changeBrightness(backdrop, evy, blendMode), backdrop);
+		u16xN result = selectLanes(started, color, backdrop);
+
+		result = convertColor(result & 0x7FFF);
+		memcpy(&framebuffer[currentScanline][x], &result, sizeof(result));
+	}
+}
+
+void GBAPPU::chooseFrameSkip() {
+	if (frameSkip == frameSkipAuto) {
+		constexpr auto frameTime = std::chrono::nanoseconds(16742706); // 280896 cycles
+		auto now = std::chrono::steady_clock::now();
+
+		if (bus.cpu.uncapFps) { // Draw about as often as a real GBA would
+			skipFrame = now < nextFrameTime;
+			if (!skipFrame)
+				nextFrameTime = now + frameTime;
+		} else { // Only skip when more than a frame behind real time
+			nextFrameTime += frameTime;
+			if ((now > (nextFrameTime + (frameTime * 8))) || (now < (nextFrameTime - (frameTime * 8)))) // Paused or too far off to catch up
+				nextFrameTime = now;
+			skipFrame = (now > (nextFrameTime + frameTime)) && (framesSkipped < maxAutoFrameSkip);
+		}
+	} else {
+		skipFrame = framesSkipped < frameSkip;
+	}
+	if (frameCounter == forceDrawFrame)
+		skipFrame = false;
+
+	framesSkipped = skipFrame ? (framesSkipped + 1) : 0;
+}
+
+void GBAPPU::incrementAffineRefs() {
+	internalBG2X += BG2PB;
+	internalBG2Y += BG2PD;
+	internalBG3X += BG3PB;
+	internalBG3Y += BG3PD;
 }
 
 u8 GBAPPU::readIO(u32 address) {
@@ -835,35 +1287,35 @@ void GBAPPU::writeIO(u32 address, u8 value) {
 		break;
 	case 0x4000028:
 		BG2X = (BG2X & 0xFFFFFF00) | value;
-		internalBG2X = (float)((i32)(BG2X << 4) >> 4) / 256;
+		internalBG2X = (i32)(BG2X << 4) >> 4;
 		break;
 	case 0x4000029:
 		BG2X = (BG2X & 0xFFFF00FF) | (value << 8);
-		internalBG2X = (float)((i32)(BG2X << 4) >> 4) / 256;
+		internalBG2X = (i32)(BG2X << 4) >> 4;
 		break;
 	case 0x400002A:
 		BG2X = (BG2X & 0xFF00FFFF) | (value << 16);
-		internalBG2X = (float)((i32)(BG2X << 4) >> 4) / 256;
+		internalBG2X = (i32)(BG2X << 4) >> 4;
 		break;
 	case 0x400002B:
 		BG2X = (BG2X & 0x00FFFFFF) | ((value & 0x0F) << 24);
-		internalBG2X = (float)((i32)(BG2X << 4) >> 4) / 256;
+		internalBG2X = (i32)(BG2X << 4) >> 4;
 		break;
 	case 0x400002C:
 		BG2Y = (BG2Y & 0xFFFFFF00) | value;
-		internalBG2Y = (float)((i32)(BG2Y << 4) >> 4) / 256;
+		internalBG2Y = (i32)(BG2Y << 4) >> 4;
 		break;
 	case 0x400002D:
 		BG2Y = (BG2Y & 0xFFFF00FF) | (value << 8);
-		internalBG2Y = (float)((i32)(BG2Y << 4) >> 4) / 256;
+		internalBG2Y = (i32)(BG2Y << 4) >> 4;
 		break;
 	case 0x400002E:
 		BG2Y = (BG2Y & 0xFF00FFFF) | (value << 16);
-		internalBG2Y = (float)((i32)(BG2Y << 4) >> 4) / 256;
+		internalBG2Y = (i32)(BG2Y << 4) >> 4;
 		break;
 	case 0x400002F:
 		BG2Y = (BG2Y & 0x00FFFFFF) | ((value & 0x0F) << 24);
-		internalBG2Y = (float)((i32)(BG2Y << 4) >> 4) / 256;
+		internalBG2Y = (i32)(BG2Y << 4) >> 4;
 		break;
 	case 0x4000030:
 		BG3PA = (BG3PA & 0xFF00) | value;
@@ -891,35 +1343,35 @@ void GBAPPU::writeIO(u32 address, u8 value) {
 		break;
 	case 0x4000038:
 		BG3X = (BG3X & 0xFFFFFF00) | value;
-		internalBG3X = (float)((i32)(BG3X << 4) >> 4) / 256;
+		internalBG3X = (i32)(BG3X << 4) >> 4;
 		break;
 	case 0x4000039:
 		BG3X = (BG3X & 0xFFFF00FF) | (value << 8);
-		internalBG3X = (float)((i32)(BG3X << 4) >> 4) / 256;
+		internalBG3X = (i32)(BG3X << 4) >> 4;
 		break;
 	case 0x400003A:
 		BG3X = (BG3X & 0xFF00FFFF) | (value << 16);
-		internalBG3X = (float)((i32)(BG3X << 4) >> 4) / 256;
+		internalBG3X = (i32)(BG3X << 4) >> 4;
 		break;
 	case 0x400003B:
 		BG3X = (BG3X & 0x00FFFFFF) | ((value & 0x0F) << 24);
-		internalBG3X = (float)((i32)(BG3X << 4) >> 4) / 256;
+		internalBG3X = (i32)(BG3X << 4) >> 4;
 		break;
 	case 0x400003C:
 		BG3Y = (BG3Y & 0xFFFFFF00) | value;
-		internalBG3Y = (float)((i32)(BG3Y << 4) >> 4) / 256;
+		internalBG3Y = (i32)(BG3Y << 4) >> 4;
 		break;
 	case 0x400003D:
 		BG3Y = (BG3Y & 0xFFFF00FF) | (value << 8);
-		internalBG3Y = (float)((i32)(BG3Y << 4) >> 4) / 256;
+		internalBG3Y = (i32)(BG3Y << 4) >> 4;
 		break;
 	case 0x400003E:
 		BG3Y = (BG3Y & 0xFF00FFFF) | (value << 16);
-		internalBG3Y = (float)((i32)(BG3Y << 4) >> 4) / 256;
+		internalBG3Y = (i32)(BG3Y << 4) >> 4;
 		break;
 	case 0x400003F:
 		BG3Y = (BG3Y & 0x00FFFFFF) | ((value & 0x0F) << 24);
-		internalBG3Y = (float)((i32)(BG3Y << 4) >> 4) / 256;
+		internalBG3Y = (i32)(BG3Y << 4) >> 4;
 		break;
 	case 0x4000040:
 		WIN0H = (WIN0H & 0xFF00) | value;
@@ -971,15 +1423,12 @@ void GBAPPU::writeIO(u32 address, u8 value) {
 		break;
 	case 0x4000052:
 		BLDALPHA = (BLDALPHA & 0xFF00) | (value & 0x1F);
-		evaCoefficientFloat = (evaCoefficient & 0x10) ? 1 : (float)evaCoefficient / 16;
 		break;
 	case 0x4000053:
 		BLDALPHA = (BLDALPHA & 0x00FF) | ((value & 0x1F) << 8);
-		evbCoefficientFloat = (evbCoefficient & 0x10) ? 1 : (float)evbCoefficient / 16;
 		break;
 	case 0x4000054:
 		BLDY = value & 0x1F;
-		evyCoefficientFloat = (evyCoefficient & 0x10) ? 1 : (float)evyCoefficient / 16;
 		break;
 	}
 }
\ No newline at end of file
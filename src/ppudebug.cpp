@@ -59,13 +59,13 @@ const int layerEntriesNum = sizeof(layerInfo)/sizeof(layerInfoEntry);
 int currentlySelectedLayer = 0;
 
 template <int bgNum, int size>
-int calculateTilemapIndex(int x, int y) {
+int calculateTilemapIndex(GameBoyAdvance& gba, int x, int y) {
 	int baseBlock;
 	switch (bgNum) {
-	case 0: baseBlock = GBA.ppu.bg0ScreenBaseBlock; break;
-	case 1: baseBlock = GBA.ppu.bg1ScreenBaseBlock; break;
-	case 2: baseBlock = GBA.ppu.bg2ScreenBaseBlock; break;
-	case 3: baseBlock = GBA.ppu.bg3ScreenBaseBlock; break;
+	case 0: baseBlock = gba.ppu.bg0ScreenBaseBlock; break;
+	case 1: baseBlock = gba.ppu.bg1ScreenBaseBlock; break;
+	case 2: baseBlock = gba.ppu.bg2ScreenBaseBlock; break;
+	case 3: baseBlock = gba.ppu.bg3ScreenBaseBlock; break;
 	}
 
 	int offset;
@@ -82,7 +82,7 @@ int calculateTilemapIndex(int x, int y) {
 		return offset + (((y % 256) / 8) * 64) + (((x % 256) / 8) * 2);
 	}
 }
-constexpr int (*tilemapIndexLUTDebug[])(int, int) = {
+constexpr int (*tilemapIndexLUTDebug[])(GameBoyAdvance&, int, int) = {
 	&calculateTilemapIndex<0, 0>,
 	&calculateTilemapIndex<0, 1>,
 	&calculateTilemapIndex<0, 2>,
@@ -103,7 +103,7 @@ constexpr int (*tilemapIndexLUTDebug[])(int, int) = {
 
 int screenXSize;
 int screenYSize;
-void drawDebugLayer(bgLayer type, u16 *buffer) {
+void drawDebugLayer(GameBoyAdvance& gba, bgLayer type, u16 *buffer) {
 	screenXSize = layerInfo[currentlySelectedLayer].xSize;
 	screenYSize = layerInfo[currentlySelectedLayer].ySize;
 	switch (type) {
@@ -116,24 +116,24 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 		int characterBaseBlock;
 		switch (type) {
 		case BG0_REGULAR:
-			screenSize = GBA.ppu.bg0ScreenSize;
-			bpp = GBA.ppu.bg0Bpp;
-			characterBaseBlock = GBA.ppu.bg0CharacterBaseBlock;
+			screenSize = gba.ppu.bg0ScreenSize;
+			bpp = gba.ppu.bg0Bpp;
+			characterBaseBlock = gba.ppu.bg0CharacterBaseBlock;
 			break;
 		case BG1_REGULAR:
-			screenSize = GBA.ppu.bg1ScreenSize;
-			bpp = GBA.ppu.bg1Bpp;
-			characterBaseBlock = GBA.ppu.bg1CharacterBaseBlock;
+			screenSize = gba.ppu.bg1ScreenSize;
+			bpp = gba.ppu.bg1Bpp;
+			characterBaseBlock = gba.ppu.bg1CharacterBaseBlock;
 			break;
 		case BG2_REGULAR:
-			screenSize = GBA.ppu.bg2ScreenSize;
-			bpp = GBA.ppu.bg2Bpp;
-			characterBaseBlock = GBA.ppu.bg2CharacterBaseBlock;
+			screenSize = gba.ppu.bg2ScreenSize;
+			bpp = gba.ppu.bg2Bpp;
+			characterBaseBlock = gba.ppu.bg2CharacterBaseBlock;
 			break;
 		case BG3_REGULAR:
-			screenSize = GBA.ppu.bg3ScreenSize;
-			bpp = GBA.ppu.bg3Bpp;
-			characterBaseBlock = GBA.ppu.bg3CharacterBaseBlock;
+			screenSize = gba.ppu.bg3ScreenSize;
+			bpp = gba.ppu.bg3Bpp;
+			characterBaseBlock = gba.ppu.bg3CharacterBaseBlock;
 			break;
 		default: // Get the compiler to shut up
 			screenSize = 0;
@@ -154,9 +154,9 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 		for (int y = 0; y < screenYSize; y++) {
 			for (int x = 0; x < screenXSize; x++) {
 				if ((x % 8) == 0) { // Fetch new tile
-					int tilemapIndex = (*tilemapIndexLUTDebug[(type * 4) + screenSize])(x, y);
+					int tilemapIndex = (*tilemapIndexLUTDebug[(type * 4) + screenSize])(gba, x, y);
 
-					u16 tilemapEntry = (GBA.ppu.vram[tilemapIndex + 1] << 8) | GBA.ppu.vram[tilemapIndex];
+					u16 tilemapEntry = (gba.ppu.vram[tilemapIndex + 1] << 8) | gba.ppu.vram[tilemapIndex];
 					paletteBank = (tilemapEntry >> 8) & 0xF0;
 					verticalFlip = tilemapEntry & 0x0800;
 					horizontalFlip = tilemapEntry & 0x0400;
@@ -169,9 +169,9 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 				u8 tileData;
 				int xMod = horizontalFlip ? (7 - (x % 8)) : (x % 8);
 				if (bpp) { // 8 bits per pixel
-					tileData = GBA.ppu.vram[tileRowAddress + xMod];
+					tileData = gba.ppu.vram[tileRowAddress + xMod];
 				} else { // 4 bits per pixel
-					tileData = GBA.ppu.vram[tileRowAddress + (xMod / 2)];
+					tileData = gba.ppu.vram[tileRowAddress + (xMod / 2)];
 
 					if (xMod & 1) {
 						tileData >>= 4;
@@ -180,9 +180,9 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 					}
 				}
 				if (tileData != 0) {
-					debugBuffer[(y * screenXSize) + x] = convertColor(GBA.ppu.paletteColors[(paletteBank * !bpp) | tileData]);
+					debugBuffer[(y * screenXSize) + x] = convertColor(gba.ppu.paletteColors[(paletteBank * !bpp) | tileData]);
 				} else {
-					debugBuffer[(y * screenXSize) + x] = convertColor(GBA.ppu.paletteColors[0]);
+					debugBuffer[(y * screenXSize) + x] = convertColor(gba.ppu.paletteColors[0]);
 				}
 			}
 		}
@@ -191,7 +191,7 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 		for (int line = 0; line < 160; line++) {
 			for (int x = 0; x < 240; x++) {
 				auto vramIndex = ((line * 240) + x) * 2;
-				u16 vramData = (GBA.ppu.vram[vramIndex + 1] << 8) | GBA.ppu.vram[vramIndex];
+				u16 vramData = (gba.ppu.vram[vramIndex + 1] << 8) | gba.ppu.vram[vramIndex];
 				buffer[(line * 240) + x] = convertColor(vramData);
 			}
 		}
@@ -201,8 +201,8 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 		for (int line = 0; line < 160; line++) {
 			for (int x = 0; x < 240; x++) {
 				auto vramIndex = (line * 240) + x + ((type == MODE4_BG2_FLIPPED) * 0xA000);
-				u8 vramData = GBA.ppu.vram[vramIndex];
-				buffer[(line * 240) + x] = convertColor(GBA.ppu.paletteColors[vramData]);
+				u8 vramData = gba.ppu.vram[vramIndex];
+				buffer[(line * 240) + x] = convertColor(gba.ppu.paletteColors[vramData]);
 			}
 		}
 		break;
@@ -211,7 +211,7 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 		for (int line = 0; line < 128; line++) {
 			for (int x = 0; x < 160; x++) {
 				auto vramIndex = (((line * 160) + x) * 2) + ((type == MODE5_BG2_FLIPPED) * 0xA000);
-				u16 vramData = (GBA.ppu.vram[vramIndex + 1] << 8) | GBA.ppu.vram[vramIndex];
+				u16 vramData = (gba.ppu.vram[vramIndex + 1] << 8) | gba.ppu.vram[vramIndex];
 				buffer[(line * 160) + x] = convertColor(vramData);
 			}
 		}
@@ -220,7 +220,7 @@ void drawDebugLayer(bgLayer type, u16 *buffer) {
 }
 
 bool showLayerView;
-void layerViewWindow() {
+void layerViewWindow(GameBoyAdvance& gba) {
 	ImGui::Begin("Layer View", &showLayerView);
 
 	if (ImGui::BeginCombo("Current Layer", layerInfo[currentlySelectedLayer].name.c_str())) {
@@ -238,10 +238,10 @@ void layerViewWindow() {
 	}
 
 	if (layerInfo[currentlySelectedLayer].enumValue >= MODE3_BG2) {
-		ImGui::Text("[%02X.%02X, %02X.%02X]\n[%02X.%02X, %02X.%02X]", GBA.ppu.BG2PA >> 8, GBA.ppu.BG2PA & 0xFF, GBA.ppu.BG2PB >> 8, GBA.ppu.BG2PB & 0xFF, GBA.ppu.BG2PC >> 8, GBA.ppu.BG2PC & 0xFF, GBA.ppu.BG2PD >> 8, GBA.ppu.BG2PD & 0xFF);
+		ImGui::Text("[%02X.%02X, %02X.%02X]\n[%02X.%02X, %02X.%02X]", gba.ppu.BG2PA >> 8, gba.ppu.BG2PA & 0xFF, gba.ppu.BG2PB >> 8, gba.ppu.BG2PB & 0xFF, gba.ppu.BG2PC >> 8, gba.ppu.BG2PC & 0xFF, gba.ppu.BG2PD >> 8, gba.ppu.BG2PD & 0xFF);
 	}
 
-	drawDebugLayer(layerInfo[currentlySelectedLayer].enumValue, debugBuffer);
+	drawDebugLayer(gba, layerInfo[currentlySelectedLayer].enumValue, debugBuffer);
 	glBindTexture(GL_TEXTURE_2D, debugTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB5_A1, screenXSize, screenYSize, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, debugBuffer);
 	ImGui::Image((void*)(intptr_t)debugTexture, ImVec2(screenXSize * 2, screenYSize * 2));
@@ -253,7 +253,7 @@ bool highColor;
 int selectedPalette;
 
 bool showTiles;
-void tilesWindow() {
+void tilesWindow(GameBoyAdvance& gba) {
 	ImGui::Begin("Tiles", &showTiles);
 
 	ImGui::Checkbox("256 Color Mode", &highColor);
@@ -276,7 +276,7 @@ void tilesWindow() {
 				int tileRowAddress = ((x + ((y / 8) * 32)) * 64) + ((y % 8) * 4);
 
 				for (int subX = 0; subX < 8; subX++)
-					debugTilesBuffer[(y * 256) + (x * 8) + subX] = convertColor(GBA.ppu.paletteColors[GBA.ppu.vram[tileRowAddress + subX]]);
+					debugTilesBuffer[(y * 256) + (x * 8) + subX] = convertColor(gba.ppu.paletteColors[gba.ppu.vram[tileRowAddress + subX]]);
 			}
 		}
 	} else {
@@ -284,14 +284,14 @@ void tilesWindow() {
 			for (int x = 0; x < (256 / 8); x++) {
 				int tileRowAddress = ((x + ((y / 8) * 32)) * 32) + ((y % 8) * 4);
 
-				debugTilesBuffer[(y * 256) + (x * 8) + 0] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 0] & 0xF)]);
-				debugTilesBuffer[(y * 256) + (x * 8) + 1] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 0] >> 4)]);
-				debugTilesBuffer[(y * 256) + (x * 8) + 2] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 1] & 0xF)]);
-				debugTilesBuffer[(y * 256) + (x * 8) + 3] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 1] >> 4)]);
-				debugTilesBuffer[(y * 256) + (x * 8) + 4] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 2] & 0xF)]);
-				debugTilesBuffer[(y * 256) + (x * 8) + 5] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 2] >> 4)]);
-				debugTilesBuffer[(y * 256) + (x * 8) + 6] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 3] & 0xF)]);
-				debugTilesBuffer[(y * 256) + (x * 8) + 7] = convertColor(GBA.ppu.paletteColors[selectedPalette | (GBA.ppu.vram[tileRowAddress + 3] >> 4)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 0] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 0] & 0xF)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 1] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 0] >> 4)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 2] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 1] & 0xF)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 3] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 1] >> 4)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 4] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 2] & 0xF)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 5] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 2] >> 4)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 6] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 3] & 0xF)]);
+				debugTilesBuffer[(y * 256) + (x * 8) + 7] = convertColor(gba.ppu.paletteColors[selectedPalette | (gba.ppu.vram[tileRowAddress + 3] >> 4)]);
 			}
 		}
 	}
@@ -309,9 +309,9 @@ void tilesWindow() {
 	((int)((((x) & 0x001F) / (float)31) * 255) << 24) | 0xFF)
 
 bool showPalette;
-void paletteWindow() {
+void paletteWindow(GameBoyAdvance& gba) {
 	static int selectedIndex;
-	u16 color = GBA.ppu.paletteColors[selectedIndex];
+	u16 color = gba.ppu.paletteColors[selectedIndex];
 
 	ImGui::Begin("Palettes", &showPalette);
 
@@ -334,7 +334,7 @@ void paletteWindow() {
 		for (int x = 0; x < 16; x++) {
 			int index = (y * 16) + x;
 			std::string id = "Color " + std::to_string(index);
-			u32 color = color555to8888(GBA.ppu.paletteColors[index]);
+			u32 color = color555to8888(gba.ppu.paletteColors[index]);
 			ImVec4 colorVec = ImVec4((color >> 24) / 255.0f, ((color >> 16) & 0xFF) / 255.0f, ((color >> 8) & 0xFF) / 255.0f, (color & 0xFF) / 255.0f);
 
 			if (ImGui::ColorButton(id.c_str(), colorVec, (selectedIndex == index) ? 0 : ImGuiColorEditFlags_NoBorder, ImVec2(10, 10)))
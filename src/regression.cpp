@@ -0,0 +1,152 @@
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "fmt/core.h"
+#include "regression.hpp"
+#include "batch.hpp"
+#include "types.hpp"
+
+// Golden files have the same name as the ROM with a .golden extension:
+// <frame> <framebuffer hash> <audio hash>
+// ...
+// Lines starting with # are comments. A ROM with a .movie file next to it is played with that movie.
+struct GoldenFile {
+	bool found;
+	std::vector<BatchCheckpoint> checkpoints;
+};
+
+static GoldenFile loadGoldenFile(std::filesystem::path goldenFilePath) {
+	GoldenFile golden{};
+	std::ifstream goldenFileStream{goldenFilePath};
+	if (!goldenFileStream.is_open())
+		return golden;
+	golden.found = true;
+
+	std::string line;
+	while (std::getline(goldenFileStream, line)) {
+		std::istringstream lineStream{line};
+		std::string first;
+		if (!(lineStream >> first) || (first[0] == '#'))
+			continue;
+
+		BatchCheckpoint checkpoint;
+		checkpoint.frame = atoi(first.c_str());
+		if ((checkpoint.frame <= 0) || !(lineStream >> std::hex >> checkpoint.frameHash >> checkpoint.audioHash))
+			continue;
+		golden.checkpoints.push_back(checkpoint);
+	}
+
+	std::sort(golden.checkpoints.begin(), golden.checkpoints.end(), [](const BatchCheckpoint& a, const BatchCheckpoint& b) { return a.frame < b.frame; });
+	return golden;
+}
+
+static int saveGoldenFile(std::filesystem::path goldenFilePath, const BatchJob& job) {
+	std::ofstream goldenFileStream{goldenFilePath, std::ios::trunc};
+	if (!goldenFileStream) {
+		printf("Failed to open/create golden file: %s\n", goldenFilePath.c_str());
+		return -1;
+	}
+
+	for (auto& checkpoint : job.checkpoints)
+		goldenFileStream << fmt::format("{} {:0>16x} {:0>16x}\n", checkpoint.frame, checkpoint.frameHash, checkpoint.audioHash);
+	goldenFileStream.close();
+
+	return 0;
+}
+
+int runRegression(std::filesystem::path romDirectory, const RegressionOptions& regressionOptions, const BatchOptions& options) {
+	std::vector<std::filesystem::path> romFilePaths;
+	std::error_code error;
+	for (auto& entry : std::filesystem::directory_iterator(romDirectory, error)) {
+		std::string extension = entry.path().extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+		if (entry.is_regular_file() && (extension == ".gba"))
+			romFilePaths.push_back(entry.path());
+	}
+	if (error) {
+		printf("Failed to open ROM directory: %s\n", romDirectory.c_str());
+		return -1;
+	}
+	std::sort(romFilePaths.begin(), romFilePaths.end());
+
+	// Checkpoints come from the golden file, or from the options when making a new one
+	std::vector<GoldenFile> goldenFiles;
+	std::vector<BatchJob> jobs;
+	for (auto& romFilePath : romFilePaths) {
+		GoldenFile golden = regressionOptions.updateGolden ? GoldenFile{} : loadGoldenFile(std::filesystem::path(romFilePath).replace_extension(".golden"));
+
+		BatchJob job{};
+		job.romFilePath = romFilePath;
+		std::filesystem::path movieFilePath = std::filesystem::path(romFilePath).replace_extension(".movie");
+		if (std::filesystem::exists(movieFilePath))
+			job.inputFilePath = movieFilePath;
+
+		if (golden.found) {
+			job.checkpoints = golden.checkpoints;
+		} else {
+			for (int frame = regressionOptions.checkpointInterval; frame <= regressionOptions.frames; frame += regressionOptions.checkpointInterval)
+				job.checkpoints.push_back({frame, 0, 0});
+			if (job.checkpoints.empty() || (job.checkpoints.back().frame != regressionOptions.frames))
+				job.checkpoints.push_back({regressionOptions.frames, 0, 0});
+		}
+		job.frames = job.checkpoints.empty() ? 0 : job.checkpoints.back().frame;
+
+		goldenFiles.push_back(golden);
+		jobs.push_back(job);
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+	runBatch(jobs, options);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	// One line per ROM with how long it took, so slowdowns show up next to the results
+	int passed = 0, failed = 0, missing = 0;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		BatchJob& job = jobs[i];
+		GoldenFile& golden = goldenFiles[i];
+		std::string romName = job.romFilePath.filename().string();
+
+		if (!job.success) {
+			printf("ERROR  %8.3fs  %s\n", 0.0, romName.c_str());
+			++failed;
+		} else if (regressionOptions.updateGolden) {
+			if (saveGoldenFile(std::filesystem::path(job.romFilePath).replace_extension(".golden"), job)) {
+				++failed;
+			} else {
+				printf("WROTE  %8.3fs  %s\n", job.seconds, romName.c_str());
+				++passed;
+			}
+		} else if (!golden.found) {
+			printf("NEW    %8.3fs  %s (no golden file, run with --update-golden)\n", job.seconds, romName.c_str());
+			++missing;
+		} else if (golden.checkpoints.empty()) {
+			printf("FAIL   %8.3fs  %s (golden file has no checkpoints)\n", job.seconds, romName.c_str());
+			++failed;
+		} else {
+			std::string difference;
+			for (size_t j = 0; j < job.checkpoints.size(); j++) {
+				bool frameMatches = job.checkpoints[j].frameHash == golden.checkpoints[j].frameHash;
+				bool audioMatches = job.checkpoints[j].audioHash == golden.checkpoints[j].audioHash;
+				if (!frameMatches || !audioMatches) {
+					difference = fmt::format(" (frame {}: {} differs)", job.checkpoints[j].frame, !frameMatches ? (!audioMatches ? "framebuffer and audio" : "framebuffer") : "audio");
+					break;
+				}
+			}
+
+			printf("%s  %8.3fs  %s%s\n", difference.empty() ? "PASS " : "FAIL ", job.seconds, romName.c_str(), difference.c_str());
+			if (difference.empty()) {
+				++passed;
+			} else {
+				++failed;
+			}
+		}
+	}
+	printf("%d passed, %d failed, %d without golden files in %.3f seconds\n", passed, failed, missing, seconds);
+
+	return (failed || missing) ? -1 : 0;
+}
@@ -0,0 +1,273 @@
+
+#include "renderthread.hpp"
+#include "gba.hpp"
+
+GBARenderThread::GBARenderThread(GameBoyAdvance& bus_) : bus(bus_) {
+	mode = RENDER_SCANLINE;
+	parallelThreads = 0;
+	currentMode = RENDER_SCANLINE;
+	running = false;
+
+	writeIndex = readIndex = 0;
+	nextWrite = 0;
+	undrawnStart = 0;
+}
+
+GBARenderThread::~GBARenderThread() {
+	if (running)
+		stop();
+}
+
+void GBARenderThread::update() {
+	RenderMode newMode = mode;
+	if (newMode == currentMode)
+		return;
+
+	if (running)
+		stop();
+	if (newMode != RENDER_SCANLINE)
+		start(newMode);
+}
+
+void GBARenderThread::start(RenderMode newMode) {
+	if (newMode == RENDER_THREAD) {
+		if (!ring)
+			ring = std::make_unique<Command[]>(ringSize);
+		renderer = std::make_unique<GBAPPU>(bus, true);
+
+		writeIndex = readIndex = 0;
+		nextWrite = 0;
+		thread = std::thread(&GBARenderThread::renderLoop, this);
+	} else {
+		pool = std::make_unique<ThreadPool>(parallelThreads);
+		chunks.resize(std::min(pool->size(), 160)); // Any more would never get a line, and the log could never be trimmed
+		for (auto& chunk : chunks) {
+			chunk.renderer = std::make_unique<GBAPPU>(bus, true);
+			chunk.position = 0;
+		}
+
+		commandLog.clear();
+		undrawnStart = 0;
+	}
+
+	bus.ppu.markAllMemoryDirty(); // The first line sends everything
+	currentMode = newMode;
+	running = true;
+}
+
+void GBARenderThread::stop() {
+	if (currentMode == RENDER_THREAD) {
+		newCommand().type = Command::QUIT;
+		publish();
+		thread.join();
+
+		renderer.reset();
+	} else {
+		pool.reset();
+		chunks.clear();
+		commandLog.clear();
+	}
+
+	currentMode = RENDER_SCANLINE;
+	running = false;
+	bus.ppu.markAllTilesDirty(); // Nothing was decoded on this side while lines were captured
+	bus.ppu.invalidateLines(); // And the framebuffer came from the renderers
+}
+
+void GBARenderThread::captureLine() {
+	GBAPPU& ppu = bus.ppu;
+
+	// Send every block written since the last line
+	for (int i = 0; i < (int)(sizeof(ppu.tileCacheDirty) / sizeof(u64)); i++) {
+		while (ppu.tileCacheDirty[i]) {
+			u32 offset = ((i * 64) + __builtin_ctzll(ppu.tileCacheDirty[i])) * 32;
+			ppu.tileCacheDirty[i] &= ppu.tileCacheDirty[i] - 1;
+
+			Command& command = newCommand();
+			command.type = Command::VRAM;
+			command.offset = offset;
+			memcpy(command.data, &ppu.vram[offset], 32);
+		}
+	}
+	while (ppu.paletteDirty) {
+		u32 offset = __builtin_ctz(ppu.paletteDirty) * 32;
+		ppu.paletteDirty &= ppu.paletteDirty - 1;
+
+		Command& command = newCommand();
+		command.type = Command::PALETTE;
+		command.offset = offset;
+		memcpy(command.data, &ppu.paletteRam[offset], 32);
+	}
+	while (ppu.oamDirty) {
+		u32 offset = __builtin_ctz(ppu.oamDirty) * 32;
+		ppu.oamDirty &= ppu.oamDirty - 1;
+
+		Command& command = newCommand();
+		command.type = Command::OAM;
+		command.offset = offset;
+		memcpy(command.data, &ppu.oam[offset], 32);
+	}
+
+	Command& command = newCommand();
+	command.type = Command::DRAW_LINE;
+	ppu.saveLineState(command.line);
+	if (currentMode == RENDER_THREAD)
+		publish();
+
+	// Same as the end of drawScanline()
+	if (!ppu.forcedBlank)
+		ppu.incrementAffineRefs();
+}
+
+void GBARenderThread::finish() {
+	if (!running)
+		return;
+
+	if (currentMode == RENDER_PARALLEL) {
+		renderLog();
+		for (auto& chunk : chunks)
+			collectStats(*chunk.renderer);
+		return;
+	}
+
+	publish();
+	u32 read;
+	while ((read = readIndex.load(std::memory_order_acquire)) != nextWrite)
+		readIndex.wait(read, std::memory_order_acquire);
+	collectStats(*renderer); // It's idle until something else is published
+}
+
+void GBARenderThread::collectStats(GBAPPU& ppu) {
+	bus.ppu.linesDrawn += ppu.linesDrawn;
+	bus.ppu.linesReused += ppu.linesReused;
+	ppu.linesDrawn = ppu.linesReused = 0;
+}
+
+GBARenderThread::Command& GBARenderThread::newCommand() {
+	if (currentMode == RENDER_PARALLEL)
+		return commandLog.emplace_back();
+
+	if ((nextWrite - readIndex.load(std::memory_order_acquire)) == ringSize) [[unlikely]] { // Full, so let the render thread catch up
+		publish();
+		u32 read;
+		while ((nextWrite - (read = readIndex.load(std::memory_order_acquire))) == ringSize)
+			readIndex.wait(read, std::memory_order_acquire);
+	}
+
+	return ring[nextWrite++ & (ringSize - 1)];
+}
+
+void GBARenderThread::publish() {
+	if (writeIndex.load(std::memory_order_relaxed) == nextWrite)
+		return;
+
+	writeIndex.store(nextWrite, std::memory_order_release);
+	writeIndex.notify_one();
+}
+
+void GBARenderThread::applyCommand(GBAPPU& ppu, const Command& command) {
+	switch (command.type) {
+	case Command::VRAM:
+		memcpy(&ppu.vram[command.offset], command.data, 32);
+		ppu.markTileDirty(command.offset);
+		break;
+	case Command::PALETTE:
+		memcpy(&ppu.paletteRam[command.offset], command.data, 32);
+		ppu.markPaletteDirty(command.offset);
+		break;
+	case Command::OAM:
+		memcpy(&ppu.oam[command.offset], command.data, 32);
+		ppu.markObjectsDirty(command.offset);
+		break;
+	default:
+		break;
+	}
+}
+
+void GBARenderThread::renderLoop() {
+	GBAPPU& ppu = *renderer;
+	u32 read = readIndex.load(std::memory_order_relaxed);
+
+	while (1) {
+		u32 written;
+		while ((written = writeIndex.load(std::memory_order_acquire)) == read)
+			writeIndex.wait(read, std::memory_order_acquire);
+
+		for (; read != written; read++) {
+			Command& command = ring[read & (ringSize - 1)];
+			switch (command.type) {
+			case Command::DRAW_LINE:
+				ppu.loadLineState(command.line);
+				ppu.drawScanline();
+				memcpy(bus.ppu.framebuffer[ppu.currentScanline], ppu.framebuffer[ppu.currentScanline], sizeof(ppu.framebuffer[0]));
+
+				// Lines are what the emulator thread waits on
+				readIndex.store(read + 1, std::memory_order_release);
+				readIndex.notify_one();
+				break;
+			case Command::QUIT:
+				readIndex.store(read + 1, std::memory_order_release);
+				return;
+			default:
+				applyCommand(ppu, command);
+				break;
+			}
+		}
+
+		readIndex.store(read, std::memory_order_release);
+		readIndex.notify_one();
+	}
+}
+
+void GBARenderThread::renderLog() {
+	undrawnLines.clear();
+	for (size_t i = undrawnStart; i < commandLog.size(); i++) {
+		if (commandLog[i].type == Command::DRAW_LINE)
+			undrawnLines.push_back(i);
+	}
+	if (undrawnLines.empty())
+		return;
+
+	// Give each renderer an even share of the lines in order
+	size_t lineCount = undrawnLines.size();
+	size_t chunkCount = std::min(chunks.size(), lineCount);
+	for (size_t i = 0; i < chunkCount; i++) {
+		size_t begin = undrawnLines[(lineCount * i) / chunkCount];
+		size_t end = undrawnLines[((lineCount * (i + 1)) / chunkCount) - 1] + 1;
+		Chunk& chunk = chunks[i];
+		pool->submit([this, &chunk, begin, end](int) { renderChunk(chunk, begin, end); });
+	}
+	pool->wait();
+	undrawnStart = commandLog.size();
+
+	// Forget whatever every renderer has already seen
+	size_t oldest = undrawnStart;
+	for (auto& chunk : chunks)
+		oldest = std::min(oldest, chunk.position);
+	if (oldest) {
+		commandLog.erase(commandLog.begin(), commandLog.begin() + oldest);
+		for (auto& chunk : chunks)
+			chunk.position -= oldest;
+		undrawnStart -= oldest;
+	}
+}
+
+void GBARenderThread::renderChunk(Chunk& chunk, size_t begin, size_t end) {
+	GBAPPU& ppu = *chunk.renderer;
+
+	// Catch up to the memory as it was before the first line, skipping lines other renderers drew
+	for (size_t i = chunk.position; i < begin; i++)
+		applyCommand(ppu, commandLog[i]);
+
+	for (size_t i = begin; i < end; i++) {
+		const Command& command = commandLog[i];
+		if (command.type == Command::DRAW_LINE) {
+			ppu.loadLineState(command.line);
+			ppu.drawScanline();
+			memcpy(bus.ppu.framebuffer[ppu.currentScanline], ppu.framebuffer[ppu.currentScanline], sizeof(ppu.framebuffer[0]));
+		} else {
+			applyCommand(ppu, command);
+		}
+	}
+	chunk.position = end;
+}
@@ -0,0 +1,220 @@
+
+#include "rewind.hpp"
+#include "gba.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+GBARewind::GBARewind(GameBoyAdvance& bus_) : bus(bus_) {
+	enabled = false;
+	rewinding = false;
+	bufferSize = 32 * 1024 * 1024;
+	lastFrame = 0;
+
+	totalBytes = 0;
+	compressing = false;
+	quit = false;
+	captured = false;
+}
+
+GBARewind::~GBARewind() {
+	if (compressThread.joinable()) {
+		{
+			std::lock_guard lock(historyMutex);
+			quit = true;
+		}
+		workAvailable.notify_all();
+		compressThread.join();
+	}
+}
+
+void GBARewind::reset() {
+	std::unique_lock lock(historyMutex);
+	workDone.wait(lock, [this] { return !compressing; });
+
+	for (auto& state : pendingStates)
+		freeBuffers.push_back(std::move(state));
+	pendingStates.clear();
+	history.clear();
+	totalBytes = 0;
+	newestState.clear();
+	captured = false;
+}
+
+void GBARewind::captureFrame() {
+	lastFrame = bus.ppu.frameCounter;
+	if (!enabled) {
+		if (captured) // Don't let a rewind jump over the frames that weren't recorded
+			reset();
+		return;
+	}
+
+	if (!compressThread.joinable())
+		compressThread = std::thread(&GBARewind::compressLoop, this);
+
+	std::vector<u8> state;
+	{
+		std::lock_guard lock(historyMutex);
+		if (pendingStates.size() >= 8) [[unlikely]] // The compression thread can't keep up, so skip a frame instead of piling up memory
+			return;
+
+		if (!freeBuffers.empty()) {
+			state = std::move(freeBuffers.back());
+			freeBuffers.pop_back();
+		}
+	}
+
+	bus.saveState(state);
+	captured = true;
+
+	{
+		std::lock_guard lock(historyMutex);
+		pendingStates.push_back(std::move(state));
+	}
+	workAvailable.notify_one();
+}
+
+void GBARewind::stepBack() {
+	{
+		std::unique_lock lock(historyMutex);
+		workDone.wait(lock, [this] { return pendingStates.empty() && !compressing; });
+
+		if (!history.empty()) {
+			applyDelta(newestState, history.back());
+			totalBytes -= history.back().data.size();
+			history.pop_back();
+		}
+		if (!newestState.empty())
+			bus.loadState(newestState);
+	}
+	lastFrame = bus.ppu.frameCounter;
+
+	// One frame back per frame of real time, or as fast as possible if the frame rate is uncapped
+	constexpr auto frameTime = std::chrono::nanoseconds(16742706); // 280896 cycles
+	auto now = std::chrono::steady_clock::now();
+	if (bus.cpu.uncapFps || (nextStepTime < (now - frameTime))) {
+		nextStepTime = now;
+	} else {
+		nextStepTime += frameTime;
+		std::this_thread::sleep_until(nextStepTime);
+	}
+}
+
+size_t GBARewind::historyFrames() {
+	std::lock_guard lock(historyMutex);
+	return history.size();
+}
+
+size_t GBARewind::historyBytes() {
+	std::lock_guard lock(historyMutex);
+	return totalBytes;
+}
+
+void GBARewind::compressLoop() {
+	std::unique_lock lock(historyMutex);
+	while (1) {
+		workAvailable.wait(lock, [this] { return quit || !pendingStates.empty(); });
+		if (quit)
+			return;
+
+		std::vector<u8> state = std::move(pendingStates.front());
+		pendingStates.pop_front();
+		compressing = true;
+		lock.unlock();
+
+		// newestState only changes on this thread while compressing is set
+		Delta delta;
+		bool haveDelta = !newestState.empty();
+		if (haveDelta)
+			encodeDelta(newestState, state, delta);
+
+		lock.lock();
+		if (haveDelta) {
+			totalBytes += delta.data.size();
+			history.push_back(std::move(delta));
+			while ((totalBytes > bufferSize) && !history.empty()) {
+				totalBytes -= history.front().data.size();
+				history.pop_front();
+			}
+		}
+		std::swap(newestState, state);
+		freeBuffers.push_back(std::move(state));
+		compressing = false;
+		workDone.notify_all();
+	}
+}
+
+// Delta format, repeated until the end of the data:
+// Number of unchanged bytes, number of changed bytes, then the XOR of each changed byte.
+// Both counts are LEB128 so the common short runs only take a byte each.
+static void writeLength(std::vector<u8>& out, size_t length) {
+	do {
+		u8 byte = length & 0x7F;
+		length >>= 7;
+		out.push_back(byte | (length ? 0x80 : 0));
+	} while (length);
+}
+
+static size_t readLength(const u8 *&in) {
+	size_t length = 0;
+	int shift = 0;
+	u8 byte;
+	do {
+		byte = *in++;
+		length |= (size_t)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return length;
+}
+
+void GBARewind::encodeDelta(const std::vector<u8>& older, const std::vector<u8>& newer, Delta& delta) {
+	delta.size = older.size();
+	delta.data.clear();
+
+	// Bytes past the end of the shorter state count as zero
+	size_t commonSize = std::min(older.size(), newer.size());
+	size_t fullSize = std::max(older.size(), newer.size());
+	auto xorAt = [&](size_t i) -> u8 {
+		if (i < commonSize) [[likely]]
+			return older[i] ^ newer[i];
+		return (i < older.size()) ? older[i] : newer[i];
+	};
+
+	size_t i = 0;
+	while (i < fullSize) {
+		size_t runStart = i;
+		while ((i + 8) <= commonSize && !memcmp(&older[i], &newer[i], 8))
+			i += 8;
+		while ((i < fullSize) && !xorAt(i))
+			++i;
+		if (i == fullSize) // Unchanged to the end
+			break;
+		writeLength(delta.data, i - runStart);
+
+		size_t changedStart = i;
+		while ((i < fullSize) && xorAt(i))
+			++i;
+		writeLength(delta.data, i - changedStart);
+		for (size_t j = changedStart; j < i; j++)
+			delta.data.push_back(xorAt(j));
+	}
+}
+
+void GBARewind::applyDelta(std::vector<u8>& state, const Delta& delta) {
+	// Pad to the longer of the two states with zeros, same as when the delta was made
+	if (delta.size > state.size())
+		state.resize(delta.size);
+
+	const u8 *in = delta.data.data();
+	const u8 *end = in + delta.data.size();
+	size_t position = 0;
+	while (in < end) {
+		position += readLength(in);
+		size_t changed = readLength(in);
+		for (size_t i = 0; i < changed; i++)
+			state[position++] ^= *in++;
+	}
+
+	state.resize(delta.size);
+}
@@ -0,0 +1,98 @@
+
+#include "threadpool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) {
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	nextQueue = 0;
+	queuedTasks = 0;
+	unfinishedTasks = 0;
+	quit = false;
+
+	for (int i = 0; i < threadCount; i++)
+		queues.push_back(std::make_unique<WorkerQueue>());
+	for (int i = 0; i < threadCount; i++)
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard lock(stateMutex);
+		quit = true;
+	}
+	workAvailable.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::submit(task newTask) {
+	// Spread tasks round robin; idle workers steal whatever doesn't balance out
+	WorkerQueue& queue = *queues[nextQueue++ % queues.size()];
+	{
+		std::lock_guard lock(queue.mutex);
+		queue.tasks.push_back(std::move(newTask));
+	}
+	{
+		std::lock_guard lock(stateMutex);
+		++queuedTasks;
+		++unfinishedTasks;
+	}
+	workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock lock(stateMutex);
+	allDone.wait(lock, [this] { return unfinishedTasks == 0; });
+}
+
+bool ThreadPool::popTask(int workerIndex, task& out) {
+	// Own queue first, newest task first since it's the most likely to still be cached
+	{
+		WorkerQueue& queue = *queues[workerIndex];
+		std::lock_guard lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			out = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			return true;
+		}
+	}
+
+	// Steal the oldest task from someone else
+	for (size_t i = 1; i < queues.size(); i++) {
+		WorkerQueue& queue = *queues[(workerIndex + i) % queues.size()];
+		std::lock_guard lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			out = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::workerLoop(int workerIndex) {
+	while (1) {
+		{
+			std::unique_lock lock(stateMutex);
+			workAvailable.wait(lock, [this] { return quit || (queuedTasks > 0); });
+			if (queuedTasks == 0) // Only gets here when quitting
+				return;
+			--queuedTasks; // Reserve a task so other workers don't go looking for it
+		}
+
+		// A task was reserved, so one is guaranteed to be in some queue
+		task currentTask;
+		while (!popTask(workerIndex, currentTask)) {}
+		currentTask(workerIndex);
+
+		{
+			std::lock_guard lock(stateMutex);
+			if (--unfinishedTasks == 0)
+				allDone.notify_all();
+		}
+	}
+}
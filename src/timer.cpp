@@ -14,12 +14,28 @@ void GBATIMER::reset() {
 	TIM3D = TIM3CNT = initialTIM3D = 0;
 }
 
-const int prescalerMasks[4] = {1, 64, 256, 1024};
+void GBATIMER::serialize(StateSerializer& state) {
+	state(initialTIM0D);
+	state(tim0Timestamp);
+	state(initialTIM1D);
+	state(tim1Timestamp);
+	state(initialTIM2D);
+	state(tim2Timestamp);
+	state(initialTIM3D);
+	state(tim3Timestamp);
 
-void GBATIMER::checkOverflowEvent(void *object) {
-	static_cast<GBATIMER *>(object)->checkOverflow();
+	state(TIM0D);
+	state(TIM0CNT);
+	state(TIM1D);
+	state(TIM1CNT);
+	state(TIM2D);
+	state(TIM2CNT);
+	state(TIM3D);
+	state(TIM3CNT);
 }
 
+constexpr int prescalerMasks[4] = {1, 64, 256, 1024};
+
 void GBATIMER::checkOverflow() {
 	bool previousOverflow = false;
 	if (tim0Enable) {
@@ -29,7 +45,7 @@ void GBATIMER::checkOverflow() {
 
 			TIM0D = initialTIM0D;
 			tim0Timestamp = bus.cpu.currentTime;
-			bus.cpu.addEvent((((0x10000 - TIM0D) * prescalerMasks[tim0Frequency]) + (tim0Timestamp & ~(prescalerMasks[tim0Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			scheduleOverflow<0>();
 
 			bus.apu.onTimer(0);
 			previousOverflow = true;
@@ -44,8 +60,7 @@ void GBATIMER::checkOverflow() {
 
 			TIM1D = initialTIM1D;
 			tim1Timestamp = bus.cpu.currentTime;
-			//bus.cpu.addEvent((0x10000 - TIM1D) * (tim1Frequency ? (16 << (2 * tim1Frequency)) : 1), &checkOverflowEvent, this);
-			bus.cpu.addEvent((((0x10000 - TIM1D) * prescalerMasks[tim1Frequency]) + (tim1Timestamp & ~(prescalerMasks[tim1Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			scheduleOverflow<1>();
 			bus.apu.onTimer(1);
 
 			previousOverflow = true;
@@ -68,8 +83,7 @@ void GBATIMER::checkOverflow() {
 
 			TIM2D = initialTIM2D;
 			tim2Timestamp = bus.cpu.currentTime;
-			//bus.cpu.addEvent((0x10000 - TIM2D) * (tim2Frequency ? (16 << (2 * tim2Frequency)) : 1), &checkOverflowEvent, this);
-			bus.cpu.addEvent((((0x10000 - TIM2D) * prescalerMasks[tim2Frequency]) + (tim2Timestamp & ~(prescalerMasks[tim2Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			scheduleOverflow<2>();
 
 			previousOverflow = true;
 		} else if (tim2Cascade && previousOverflow) { // Cascade
@@ -90,8 +104,7 @@ void GBATIMER::checkOverflow() {
 
 			TIM3D = initialTIM3D;
 			tim3Timestamp = bus.cpu.currentTime;
-			//bus.cpu.addEvent((0x10000 - TIM3D) * (tim3Frequency ? (16 << (2 * tim3Frequency)) : 1), &checkOverflowEvent, this);
-			bus.cpu.addEvent((((0x10000 - TIM3D) * prescalerMasks[tim3Frequency]) + (tim3Timestamp & ~(prescalerMasks[tim3Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			scheduleOverflow<3>();
 		} else if (tim3Cascade && previousOverflow) { // Cascade
 			if (++TIM3D == 0) { // Cascade Overflow
 				if (tim3Irq)
@@ -101,6 +114,36 @@ void GBATIMER::checkOverflow() {
 	}
 }
 
+template <int timer>
+void GBATIMER::scheduleOverflow() {
+	switch (timer) {
+	case 0:
+		bus.cpu.reschedule(GBACPU::EVENT_TIMER0, ((0x10000 - TIM0D) * prescalerMasks[tim0Frequency]) + (tim0Timestamp & ~(prescalerMasks[tim0Frequency] - 1)));
+		break;
+	case 1:
+		if (tim1Cascade) {
+			bus.cpu.cancel(GBACPU::EVENT_TIMER1);
+		} else {
+			bus.cpu.reschedule(GBACPU::EVENT_TIMER1, ((0x10000 - TIM1D) * prescalerMasks[tim1Frequency]) + (tim1Timestamp & ~(prescalerMasks[tim1Frequency] - 1)));
+		}
+		break;
+	case 2:
+		if (tim2Cascade) {
+			bus.cpu.cancel(GBACPU::EVENT_TIMER2);
+		} else {
+			bus.cpu.reschedule(GBACPU::EVENT_TIMER2, ((0x10000 - TIM2D) * prescalerMasks[tim2Frequency]) + (tim2Timestamp & ~(prescalerMasks[tim2Frequency] - 1)));
+		}
+		break;
+	case 3:
+		if (tim3Cascade) {
+			bus.cpu.cancel(GBACPU::EVENT_TIMER3);
+		} else {
+			bus.cpu.reschedule(GBACPU::EVENT_TIMER3, ((0x10000 - TIM3D) * prescalerMasks[tim3Frequency]) + (tim3Timestamp & ~(prescalerMasks[tim3Frequency] - 1)));
+		}
+		break;
+	}
+}
+
 template <int timer>
 u64 GBATIMER::getDValue() {
 	switch (timer) {
@@ -170,10 +213,13 @@ void GBATIMER::writeIO(u32 address, u8 value) {
 		if ((value & 0x80) && (!tim0Enable || ((value & 0x03) != tim0Frequency))) { // Enabling the timer or changing frequency
 			TIM0D = initialTIM0D;
 			tim0Timestamp = bus.cpu.currentTime + 2;
-			bus.cpu.addEvent((((0x10000 - TIM0D) * prescalerMasks[tim0Frequency]) + (tim0Timestamp & ~(prescalerMasks[tim0Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			TIM0CNT = value & 0xC3;
+			scheduleOverflow<0>();
 		}
-		if (!(value & 0x80) && tim0Enable) // Disabling the timer
+		if (!(value & 0x80) && tim0Enable) { // Disabling the timer
 			TIM0D = getDValue<0>();
+			bus.cpu.cancel(GBACPU::EVENT_TIMER0);
+		}
 
 		TIM0CNT = value & 0xC3;
 		break;
@@ -187,10 +233,13 @@ void GBATIMER::writeIO(u32 address, u8 value) {
 		if ((value & 0x80) && (!tim1Enable || ((value & 0x03) != tim1Frequency))) { // Enabling the timer or changing frequency
 			TIM1D = initialTIM1D;
 			tim1Timestamp = bus.cpu.currentTime + 2;
-			bus.cpu.addEvent((((0x10000 - TIM1D) * prescalerMasks[tim1Frequency]) + (tim1Timestamp & ~(prescalerMasks[tim1Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			TIM1CNT = value & 0xC7;
+			scheduleOverflow<1>();
 		}
-		if (!(value & 0x80) && tim1Enable) // Disabling the timer
+		if (!(value & 0x80) && tim1Enable) { // Disabling the timer
 			TIM1D = getDValue<1>();
+			bus.cpu.cancel(GBACPU::EVENT_TIMER1);
+		}
 
 		TIM1CNT = value & 0xC7;
 		break;
@@ -204,10 +253,13 @@ void GBATIMER::writeIO(u32 address, u8 value) {
 		if ((value & 0x80) && (!tim2Enable || ((value & 0x03) != tim2Frequency))) { // Enabling the timer or changing frequency
 			TIM2D = initialTIM2D;
 			tim2Timestamp = bus.cpu.currentTime + 2;
-			bus.cpu.addEvent((((0x10000 - TIM2D) * prescalerMasks[tim2Frequency]) + (tim2Timestamp & ~(prescalerMasks[tim2Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			TIM2CNT = value & 0xC7;
+			scheduleOverflow<2>();
 		}
-		if (!(value & 0x80) && tim2Enable) // Disabling the timer
+		if (!(value & 0x80) && tim2Enable) { // Disabling the timer
 			TIM2D = getDValue<2>();
+			bus.cpu.cancel(GBACPU::EVENT_TIMER2);
+		}
 
 		TIM2CNT = value & 0xC7;
 		break;
@@ -221,10 +273,13 @@ void GBATIMER::writeIO(u32 address, u8 value) {
 		if ((value & 0x80) && (!tim3Enable || ((value & 0x03) != tim3Frequency))) { // Enabling the timer or changing frequency
 			TIM3D = initialTIM3D;
 			tim3Timestamp = bus.cpu.currentTime + 2;
-			bus.cpu.addEvent((((0x10000 - TIM3D) * prescalerMasks[tim3Frequency]) + (tim3Timestamp & ~(prescalerMasks[tim3Frequency] - 1))) - bus.cpu.currentTime, &checkOverflowEvent, this);
+			TIM3CNT = value & 0xC7;
+			scheduleOverflow<3>();
 		}
-		if (!(value & 0x80) && tim3Enable) // Disabling the timer
+		if (!(value & 0x80) && tim3Enable) { // Disabling the timer
 			TIM3D = getDValue<3>();
+			bus.cpu.cancel(GBACPU::EVENT_TIMER3);
+		}
 
 		TIM3CNT = value & 0xC7;
 		break;